@@ -0,0 +1,565 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <QGuiApplication>
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QScopedPointer>
+#include <QImage>
+#include <QPixmap>
+#include <QSet>
+#include <QTouchEvent>
+#include <qmath.h>
+
+#include "../../puzzle/puzzlegame.h"
+#include "../../puzzle/puzzlepiece.h"
+#include "../../puzzle/puzzlepieceprimitive.h"
+#include "../../puzzle/creation/imageprocessor.h"
+#include "../../puzzle/creation/shapeprocessor.h"
+#include "../../helpers/allocationcounter.h"
+#include "../syntheticimage.h"
+
+// Hot path micro-benchmarks
+// ----------
+// Every function that is called for every piece (while loading or on every input event)
+// is measured on its own, on boards from 3x3 to 100x100 pieces.
+// The boards are created without the loader: the pieces have the same shapes and
+// positions as in a real game, but their pixmaps are not painted.
+// Run with -help to see the options of QTestLib, eg. -callgrind or -tickcounter.
+// ----------
+
+// The size of the pieces on the board, the viewport grows with the number of pieces
+#define HOTPATHS_UNIT_SIZE 48
+// How many points are hit tested and how many pieces are raised in one iteration
+#define HOTPATHS_PROBE_COUNT 100
+// How many move events the scripted drags have, and how far the rotating pointers are from the center
+#define HOTPATHS_DRAG_STEPS 40
+#define HOTPATHS_DRAG_RADIUS 6
+
+using namespace Puzzle::Creation;
+
+struct Board
+{
+    ImageProcessor *imageProcessor;
+    ShapeProcessor *shapeProcessor;
+    PuzzleGame *game;
+    QVector<int> statuses;
+    QVector<PuzzlePiece*> pieces;
+    // The pieces in descending z order, as the input handlers use them
+    QVector<PuzzlePiece*> sortedPieces;
+
+    Board() : imageProcessor(0), shapeProcessor(0), game(0) { }
+    ~Board() { delete game; delete shapeProcessor; delete imageProcessor; }
+};
+
+// Collects the changes of the pieces between two frames, like the board does.
+// ----------
+// The board needs Qt Quick, so this uses the same per-piece flags and reused queues
+// as PuzzleBoardItem::queueChange(), which lets the drags be checked together with
+// the slots that get the signals of the game.
+// ----------
+class ChangeListener : public QObject
+{
+    Q_OBJECT
+    QVector<PuzzlePiece*> _raised, _transformations, _primitives;
+    QVector<quint8> _flags;
+    int _changedFrames;
+
+    void queue(QVector<PuzzlePiece*> &queue, PuzzlePiece *piece, int flag)
+    {
+        if (piece->index() >= _flags.count())
+            _flags.resize(piece->index() + 1);
+        if (_flags[piece->index()] & flag)
+            return;
+        _flags[piece->index()] |= flag;
+        queue.append(piece);
+    }
+
+public:
+    explicit ChangeListener(PuzzleGame *game) : QObject(game), _changedFrames(0)
+    {
+        _raised.reserve(game->puzzleItems().count());
+        _transformations.reserve(game->puzzleItems().count());
+        _primitives.reserve(game->puzzleItems().count());
+
+        connect(game, SIGNAL(pieceRaised(PuzzlePiece*)), this, SLOT(onPieceRaised(PuzzlePiece*)));
+        connect(game, SIGNAL(pieceTransformationChanged(PuzzlePiece*)), this, SLOT(onPieceTransformationChanged(PuzzlePiece*)));
+        connect(game, SIGNAL(piecePrimitivesChanged(PuzzlePiece*)), this, SLOT(onPiecePrimitivesChanged(PuzzlePiece*)));
+    }
+
+    int changedFrames() const { return _changedFrames; }
+
+    // Empties the queues, like the board after an update
+    void frame()
+    {
+        if (!_raised.isEmpty() || !_transformations.isEmpty() || !_primitives.isEmpty())
+            _changedFrames++;
+
+        _flags.fill(0);
+        _raised.resize(0);
+        _transformations.resize(0);
+        _primitives.resize(0);
+    }
+
+public slots:
+    void onPieceRaised(PuzzlePiece *piece) { queue(_raised, piece, 0x1); }
+    void onPieceTransformationChanged(PuzzlePiece *piece) { queue(_transformations, piece, 0x2); }
+    void onPiecePrimitivesChanged(PuzzlePiece *piece) { queue(_primitives, piece, 0x4); }
+};
+
+class HotPathsBenchmark : public QObject
+{
+    Q_OBJECT
+    QTemporaryDir _dir;
+    QString _imagePath;
+
+    void addBoardSizes();
+    Board *createBoard(int rows, int cols);
+
+private slots:
+    void initTestCase();
+
+    void getPuzzlePieceShapeCold_data() { addBoardSizes(); }
+    void getPuzzlePieceShapeCold();
+    void getPuzzlePieceShapeWarm_data() { addBoardSizes(); }
+    void getPuzzlePieceShapeWarm();
+    void match_data() { addBoardSizes(); }
+    void match();
+    void drawPiece_data() { addBoardSizes(); }
+    void drawPiece();
+    void drawStroke_data() { addBoardSizes(); }
+    void drawStroke();
+    void findPuzzleItem_data() { addBoardSizes(); }
+    void findPuzzleItem();
+    void findPuzzleItemExhaustive_data() { addBoardSizes(); }
+    void findPuzzleItemExhaustive();
+    void checkMergeability_data() { addBoardSizes(); }
+    void checkMergeability();
+    void mapToParent_data() { addBoardSizes(); }
+    void mapToParent();
+    void mapFromParent_data() { addBoardSizes(); }
+    void mapFromParent();
+    void raise_data() { addBoardSizes(); }
+    void raise();
+    void setNeighbours_data() { addBoardSizes(); }
+    void setNeighbours();
+    void dragAllocations_data() { addBoardSizes(); }
+    void dragAllocations();
+};
+
+void HotPathsBenchmark::initTestCase()
+{
+    QVERIFY(_dir.isValid());
+    _imagePath = _dir.path() + "/hotpaths.jpg";
+    QVERIFY(saveSyntheticImage(_imagePath, QSize(2048, 1536)));
+}
+
+void HotPathsBenchmark::addBoardSizes()
+{
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<int>("cols");
+
+    QTest::newRow("3x3") << 3 << 3;
+    QTest::newRow("10x10") << 10 << 10;
+    QTest::newRow("30x30") << 30 << 30;
+    QTest::newRow("100x100") << 100 << 100;
+}
+
+// Creates the pieces the same way as PuzzleGameLoader, except for painting them
+Board *HotPathsBenchmark::createBoard(int rows, int cols)
+{
+    Board *board = new Board();
+    QSize viewport(MAX(800, cols * HOTPATHS_UNIT_SIZE), MAX(480, rows * HOTPATHS_UNIT_SIZE));
+
+    board->imageProcessor = new ImageProcessor(_imagePath, viewport, rows, cols, 3);
+    const GameDescriptor &desc = board->imageProcessor->descriptor();
+    board->shapeProcessor = new ShapeProcessor(desc);
+    board->statuses.fill(0, rows * cols);
+    generatePuzzlePieceStatuses(rows, cols, board->statuses.data(), 0);
+
+    board->game = new PuzzleGame();
+    board->game->setWidth(viewport.width());
+    board->game->setHeight(viewport.height());
+    board->game->setBoardSize(cols, rows);
+
+    // The pixmaps are only used for the size of the pieces, so they can be shared
+    QPixmap pixmap(desc.unitSize.width() + desc.tabFull * 2, desc.unitSize.height() + desc.tabFull * 2);
+    pixmap.fill(Qt::transparent);
+
+    qreal   w0 = (desc.viewportSize.width() - desc.cols * desc.unitSize.width()) / 2,
+            h0 = (desc.viewportSize.height() - desc.rows * desc.unitSize.height()) / 2;
+
+    for (int i = 0; i < cols; i++)
+    {
+        for (int j = 0; j < rows; j++)
+        {
+            int status = board->statuses[i * rows + j];
+            Correction corr = board->shapeProcessor->getCorrectionFor(status);
+            QPointF supposed(w0 + (i * desc.unitSize.width()) + corr.sxCorrection,
+                             h0 + (j * desc.unitSize.height()) + corr.syCorrection);
+
+            PuzzlePiecePrimitive *primitive = new PuzzlePiecePrimitive();
+            primitive->setPixmap(pixmap);
+            primitive->setHitMask(board->shapeProcessor->getPuzzlePieceHitMask(status));
+            primitive->setUsabilityRects(QVector<QRectF>() << getUsabilityRect(desc, corr));
+
+            PuzzlePiece *item = new PuzzlePiece(board->game);
+            item->addPrimitive(primitive, QPointF(0, 0));
+            item->setPuzzleCoordinates(QPoint(i, j));
+            item->setSupposedPosition(supposed);
+            item->setPos(supposed);
+            item->setTabStatus(status);
+            item->setTransformOriginPoint(QPointF(desc.unitSize.width() / 2, desc.unitSize.height() / 2));
+
+            board->game->addPuzzleItem(item);
+            board->pieces.append(item);
+        }
+    }
+
+    board->sortedPieces = board->game->puzzleItems().toList().toVector();
+    qSort(board->sortedPieces.begin(), board->sortedPieces.end(), PuzzlePiece::puzzleItemDescLessThan);
+    return board;
+}
+
+void HotPathsBenchmark::getPuzzlePieceShapeCold()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+
+    QBENCHMARK
+    {
+        ShapeProcessor shapeProcessor(board->imageProcessor->descriptor());
+
+        foreach (int status, board->statuses)
+            shapeProcessor.getPuzzlePieceShape(status);
+    }
+}
+
+void HotPathsBenchmark::getPuzzlePieceShapeWarm()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+
+    foreach (int status, board->statuses)
+        board->shapeProcessor->getPuzzlePieceShape(status);
+
+    QBENCHMARK
+    {
+        foreach (int status, board->statuses)
+            board->shapeProcessor->getPuzzlePieceShape(status);
+    }
+}
+
+void HotPathsBenchmark::match()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    const QVector<int> &statuses = board->statuses;
+    int matches = 0;
+
+    QBENCHMARK
+    {
+        for (int k = 1; k < statuses.count(); k++)
+            matches += board->shapeProcessor->match(statuses[k - 1], statuses[k]) != NoMatch;
+    }
+
+    QVERIFY(matches >= 0);
+}
+
+void HotPathsBenchmark::drawPiece()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    QVector<CoverageMask> masks;
+    QVector<Correction> corrections;
+
+    foreach (int status, board->statuses)
+    {
+        masks.append(board->shapeProcessor->getPuzzlePieceMask(status));
+        corrections.append(board->shapeProcessor->getCorrectionFor(status));
+    }
+
+    QBENCHMARK
+    {
+        for (int i = 0; i < cols; i++)
+            for (int j = 0; j < rows; j++)
+                board->imageProcessor->drawPiece(i, j, masks[i * rows + j], corrections[i * rows + j]);
+    }
+}
+
+void HotPathsBenchmark::drawStroke()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    QVector<CoverageMask> strokeMasks;
+    QSet<int> canonicalStatuses;
+
+    // The loader only paints the stroke of every canonical status once
+    foreach (int status, board->statuses)
+    {
+        StrokeInfo info = board->shapeProcessor->getStrokeInfo(status);
+
+        if (!canonicalStatuses.contains(info.canonicalStatus))
+        {
+            canonicalStatuses.insert(info.canonicalStatus);
+            strokeMasks.append(board->shapeProcessor->getPuzzlePieceStrokeMask(status));
+        }
+    }
+
+    QBENCHMARK
+    {
+        foreach (const CoverageMask &strokeMask, strokeMasks)
+            ImageProcessor::drawStroke(strokeMask);
+    }
+}
+
+// Points spread evenly over the board, most of them are on a piece
+static QVector<QPointF> hitTestProbes(const PuzzleGame *game)
+{
+    QVector<QPointF> probes;
+
+    for (int k = 0; k < HOTPATHS_PROBE_COUNT; k++)
+        probes.append(QPointF((k % 10 + 0.5) * game->width() / 10, (k / 10 + 0.5) * game->height() / 10));
+
+    return probes;
+}
+
+// The hit test of the input handlers, which uses the spatial index
+void HotPathsBenchmark::findPuzzleItem()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    QVector<QPointF> probes = hitTestProbes(board->game);
+    int found = 0;
+
+    QBENCHMARK
+    {
+        foreach (const QPointF &p, probes)
+            found += board->game->findPuzzleItem(p) != 0;
+    }
+
+    QVERIFY(found > 0);
+}
+
+// The exact hit test of every piece, in z order
+void HotPathsBenchmark::findPuzzleItemExhaustive()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    QVector<QPointF> probes = hitTestProbes(board->game);
+    int found = 0;
+
+    QBENCHMARK
+    {
+        foreach (const QPointF &p, probes)
+            found += PuzzleGame::findPuzzleItem(p, board->sortedPieces) != 0;
+    }
+
+    QVERIFY(found > 0);
+}
+
+void HotPathsBenchmark::checkMergeability()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    board->game->setNeighbours(cols, rows);
+    int mergeable = 0;
+
+    QBENCHMARK
+    {
+        foreach (PuzzlePiece *piece, board->pieces)
+            foreach (PuzzlePiece *neighbour, piece->neighbours())
+                mergeable += piece->checkMergeability(neighbour);
+    }
+
+    QVERIFY(mergeable > 0);
+}
+
+void HotPathsBenchmark::mapToParent()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    QPointF sum;
+
+    QBENCHMARK
+    {
+        foreach (PuzzlePiece *piece, board->pieces)
+            sum += piece->mapToParent(QPointF(10, 10));
+    }
+
+    QVERIFY(!sum.isNull());
+}
+
+void HotPathsBenchmark::mapFromParent()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    QPointF sum;
+
+    QBENCHMARK
+    {
+        foreach (PuzzlePiece *piece, board->pieces)
+            sum += piece->mapFromParent(QPointF(10, 10));
+    }
+
+    QVERIFY(!sum.isNull());
+}
+
+void HotPathsBenchmark::raise()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+
+    // Raise pieces from all over the z order, like when the user grabs them
+    QBENCHMARK
+    {
+        for (int k = 0; k < HOTPATHS_PROBE_COUNT; k++)
+            board->pieces[(k * 7919) % board->pieces.count()]->raise();
+    }
+}
+
+void HotPathsBenchmark::setNeighbours()
+{
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+
+    QBENCHMARK
+    {
+        board->game->setNeighbours(cols, rows);
+    }
+
+    QCOMPARE(board->pieces.first()->neighbours().count(), 2);
+}
+
+// Two touch points on the opposite sides of the center, rotated by the given angle
+static QTouchEvent *touchEvent(QEvent::Type type, Qt::TouchPointState state, const QPointF &center, qreal angle)
+{
+    QList<QTouchEvent::TouchPoint> points;
+
+    for (int k = 0; k < 2; k++)
+    {
+        qreal a = angle + k * M_PI;
+        QTouchEvent::TouchPoint point(k);
+        point.setState(state);
+        point.setPos(center + QPointF(qCos(a), qSin(a)) * HOTPATHS_DRAG_RADIUS);
+        point.setScreenPos(point.pos());
+        points.append(point);
+    }
+
+    return new QTouchEvent(type, 0, Qt::NoModifier, state, points);
+}
+
+// Drags the piece at the center away and back, rotates it with the mouse and then with two fingers
+// (There is a frame after every event, as if the display was always faster than the input.)
+static void scriptedDrag(PuzzleGame *game, ChangeListener *listener, const QPointF &center, const QVector<QTouchEvent*> &touchEvents)
+{
+    game->handleMousePress(Qt::LeftButton, center);
+    listener->frame();
+    for (int k = 1; k <= HOTPATHS_DRAG_STEPS; k++)
+    {
+        game->handleMouseMove(center + QPointF(MIN(k, HOTPATHS_DRAG_STEPS - k) * 2, MIN(k, HOTPATHS_DRAG_STEPS - k)));
+        listener->frame();
+    }
+    game->handleMouseRelease(Qt::LeftButton, center);
+    listener->frame();
+
+    QPointF start = center + QPointF(HOTPATHS_DRAG_RADIUS, 0);
+    game->handleMousePress(Qt::RightButton, start);
+    listener->frame();
+    for (int k = 1; k <= HOTPATHS_DRAG_STEPS; k++)
+    {
+        qreal a = 2 * M_PI * k / HOTPATHS_DRAG_STEPS;
+        game->handleMouseMove(center + QPointF(qCos(a), qSin(a)) * HOTPATHS_DRAG_RADIUS);
+        listener->frame();
+    }
+    game->handleMouseRelease(Qt::RightButton, start);
+    listener->frame();
+
+    for (int k = 0; k < touchEvents.count(); k++)
+    {
+        game->handleTouchEvent(touchEvents[k]);
+        listener->frame();
+    }
+}
+
+// Not a benchmark: the input handlers must not allocate memory while a piece is dragged,
+// rotated and checked for merging, except for the first time, when the reused buffers grow
+void HotPathsBenchmark::dragAllocations()
+{
+    if (!AllocationCounter::isEnabled())
+        QSKIP("Build with PUZZLE_MASTER_COUNT_ALLOCATIONS to count the allocations.");
+
+    QFETCH(int, rows);
+    QFETCH(int, cols);
+    QScopedPointer<Board> board(createBoard(rows, cols));
+    PuzzleGame *game = board->game;
+
+    // The pieces are where they belong, so they are checked for merging, but nothing is merged
+    game->setNeighbours(cols, rows);
+    game->setTolerance(0);
+    game->enable();
+
+    PuzzlePiece *piece = board->pieces[board->pieces.count() / 2];
+    QPointF center = piece->mapToParent(piece->centerPoint());
+    QCOMPARE(game->findPuzzleItem(center), piece);
+
+    // The events are created in advance, because they allocate
+    QVector<QTouchEvent*> touchEvents;
+    touchEvents.append(touchEvent(QEvent::TouchBegin, Qt::TouchPointPressed, center, 0));
+    for (int k = 1; k < HOTPATHS_DRAG_STEPS; k++)
+        touchEvents.append(touchEvent(QEvent::TouchUpdate, Qt::TouchPointMoved, center, 2 * M_PI * k / HOTPATHS_DRAG_STEPS));
+    touchEvents.append(touchEvent(QEvent::TouchEnd, Qt::TouchPointReleased, center, 2 * M_PI));
+
+    // The changes are collected like the board collects them, with the same signals and slots
+    ChangeListener *listener = new ChangeListener(game);
+    scriptedDrag(game, listener, center, touchEvents);
+
+    int changedFrames = listener->changedFrames();
+    qint64 before = AllocationCounter::count();
+    scriptedDrag(game, listener, center, touchEvents);
+    qint64 allocations = AllocationCounter::count() - before;
+
+    qDeleteAll(touchEvents);
+    QCOMPARE(allocations, (qint64) 0);
+    QVERIFY(listener->changedFrames() > changedFrames);
+    QCOMPARE(game->puzzleItems().count(), rows * cols);
+}
+
+int main(int argc, char *argv[])
+{
+    // No window is ever shown, but the pieces have QPixmaps, which need a platform plugin
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    HotPathsBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "hotpaths.moc"
@@ -0,0 +1,42 @@
+# This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+
+# Micro-benchmarks of the functions that are called for every piece, see hotpaths.cpp
+
+lessThan(QT_MAJOR_VERSION, 5) {
+    error(The hot path benchmarks require Qt 5 but Qt $$[QT_VERSION] was detected.)
+}
+
+QT = core gui testlib
+
+include(../common.pri)
+
+# Count the heap allocations, so that the input handlers can be checked for not allocating
+# NOTE: this makes every allocation a little slower, for every benchmark
+DEFINES += PUZZLE_MASTER_COUNT_ALLOCATIONS
+
+SOURCES += \
+    hotpaths.cpp \
+    ../../helpers/allocationcounter.cpp
+
+HEADERS += \
+    ../../helpers/allocationcounter.h
+
+TARGET = puzzle-master-hotpaths
+TEMPLATE = app
+CONFIG += testcase
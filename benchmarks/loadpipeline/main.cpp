@@ -0,0 +1,358 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QImage>
+#include <QImageReader>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QDebug>
+#include <cstdio>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#include "../../puzzle/puzzlegame.h"
+#include "../../puzzle/puzzlegameloader.h"
+#include "../../puzzle/creation/puzzlecache.h"
+#include "../syntheticimage.h"
+
+// Load pipeline benchmark
+// ----------
+// Loads games with the same code as the app, on the offscreen platform,
+// and prints how long the phases of the loading took as JSON.
+// Every configuration is loaded in its own process, so that the peak RSS
+// and the caches of the process (eg. the shape processor) belong to that configuration only.
+// The puzzle cache is disabled, unless --cache is given.
+// ----------
+
+#define LOADPIPELINE_DEFAULT_IMAGES "image4.jpg,image2.jpg,image16.jpg"
+#define LOADPIPELINE_DEFAULT_SYNTHETIC "1024x768,2048x1536,4096x3072"
+#define LOADPIPELINE_DEFAULT_GRIDS "3x4,6x8,12x16"
+#define LOADPIPELINE_DEFAULT_STROKES "1,3"
+#define LOADPIPELINE_DEFAULT_VIEWPORT "800x480"
+#define LOADPIPELINE_DEFAULT_SEED "1"
+
+struct LoadConfig
+{
+    QString image;
+    QSize viewport;
+    int rows, cols, strokeThickness;
+};
+
+static QSize parseSize(const QString &str)
+{
+    QStringList parts = str.split('x');
+
+    if (parts.count() != 2)
+        return QSize();
+
+    return QSize(parts[0].toInt(), parts[1].toInt());
+}
+
+static QStringList splitValues(const QStringList &values)
+{
+    QStringList result;
+
+    foreach (const QString &value, values)
+        result += value.split(',', QString::SkipEmptyParts);
+
+    return result;
+}
+
+// In kilobytes, or -1 if it's not known on this platform
+static qint64 peakRss()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / 1024;
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return -1;
+#if defined(Q_OS_MAC)
+    // NOTE: macOS reports it in bytes, everything else in kilobytes
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+// Saves a synthetic image of the given size into the directory and returns its path
+static QString createSyntheticImage(const QString &dir, const QSize &size)
+{
+    QString path = QString("%1/synthetic-%2x%3.jpg").arg(dir).arg(size.width()).arg(size.height());
+    return saveSyntheticImage(path, size) ? path : QString();
+}
+
+// Loads a single game in this process and prints the results
+static int runSingle(const LoadConfig &config, bool useCache, unsigned seed)
+{
+    Puzzle::Creation::PuzzleCache::setEnabled(useCache);
+    qsrand(seed);
+
+    PuzzleGame game;
+    game.setWidth(config.viewport.width());
+    game.setHeight(config.viewport.height());
+    game.setStrokeThickness(config.strokeThickness);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    PuzzleGameLoader *loader = game.startGame(config.image, config.rows, config.cols, false);
+    bool success = false;
+
+    if (loader)
+    {
+        QObject::connect(loader, &PuzzleGameLoader::finished, [&success](bool ok) {
+            success = ok;
+            QCoreApplication::quit();
+        });
+        QCoreApplication::exec();
+    }
+
+    qint64 total = timer.elapsed();
+
+    // The game may still be written to the cache
+    QThreadPool::globalInstance()->waitForDone();
+
+    QSize imageSize = QImageReader(config.image).size();
+    QJsonObject result;
+    result["image"] = config.image;
+    result["imageWidth"] = imageSize.width();
+    result["imageHeight"] = imageSize.height();
+    result["viewportWidth"] = config.viewport.width();
+    result["viewportHeight"] = config.viewport.height();
+    result["rows"] = config.rows;
+    result["cols"] = config.cols;
+    result["strokeThickness"] = config.strokeThickness;
+    result["success"] = success;
+    result["pieces"] = game.puzzleItems().count();
+
+    if (loader)
+    {
+        const PuzzleGameLoaderTimings &timings = loader->timings();
+        result["cached"] = timings.cached;
+        result["decodeMs"] = timings.decode;
+        result["shapeMs"] = timings.shape;
+        result["paintMs"] = timings.paint;
+        result["piecesMs"] = timings.pieces;
+        result["neighboursMs"] = timings.neighbours;
+    }
+
+    result["totalMs"] = total;
+    result["peakRssKb"] = peakRss();
+
+    printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+    return success ? 0 : 1;
+}
+
+// Loads a single game in a child process
+static QJsonObject runInChild(const LoadConfig &config, const QStringList &options, bool verbose)
+{
+    QStringList args;
+    args << "--single"
+         << "--image" << config.image
+         << "--grid" << QString("%1x%2").arg(config.rows).arg(config.cols)
+         << "--stroke" << QString::number(config.strokeThickness)
+         << "--viewport" << QString("%1x%2").arg(config.viewport.width()).arg(config.viewport.height())
+         << options;
+
+    QProcess process;
+    if (verbose)
+        process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    else
+        process.setStandardErrorFile(QProcess::nullDevice());
+
+    process.start(QCoreApplication::applicationFilePath(), args);
+    process.waitForFinished(-1);
+
+    QByteArray output = process.readAllStandardOutput().trimmed();
+    QJsonObject result = QJsonDocument::fromJson(output.mid(output.lastIndexOf('\n') + 1)).object();
+
+    if (result.isEmpty())
+    {
+        qWarning() << "the benchmark process crashed with" << args;
+        result["image"] = config.image;
+        result["rows"] = config.rows;
+        result["cols"] = config.cols;
+        result["strokeThickness"] = config.strokeThickness;
+        result["success"] = false;
+    }
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    // No window is ever shown, but the pieces are QPixmaps, which need a platform plugin
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    app.setApplicationName("puzzle-master-loadpipeline");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures how long it takes to load a game of Puzzle Master.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("image", "Image file to load, can be given more than once. Bundled pictures are looked up by name.", "path"));
+    parser.addOption(QCommandLineOption("synthetic", "Generated image of the given size, can be given more than once.", "WxH"));
+    parser.addOption(QCommandLineOption("grid", "Rows and columns, can be given more than once.", "ROWSxCOLS"));
+    parser.addOption(QCommandLineOption("stroke", "Stroke thickness, can be given more than once.", "n"));
+    parser.addOption(QCommandLineOption("viewport", "Size of the game board.", "WxH", LOADPIPELINE_DEFAULT_VIEWPORT));
+    parser.addOption(QCommandLineOption("seed", "Seed of the random numbers, the same seed gives the same pieces.", "n", LOADPIPELINE_DEFAULT_SEED));
+    parser.addOption(QCommandLineOption("repeat", "How many times every configuration is loaded.", "n", "1"));
+    parser.addOption(QCommandLineOption("cache", "Allow loading the games from the puzzle cache."));
+    parser.addOption(QCommandLineOption("output", "Write the JSON to this file instead of the standard output.", "file"));
+    parser.addOption(QCommandLineOption("verbose", "Show the debug output of the game."));
+    parser.addOption(QCommandLineOption("single", "Load only one game in this process (used internally)."));
+    parser.process(app);
+
+    bool useCache = parser.isSet("cache");
+    unsigned seed = parser.value("seed").toUInt();
+    QSize viewport = parseSize(parser.value("viewport"));
+    QStringList grids = splitValues(parser.values("grid"));
+    QStringList strokes = splitValues(parser.values("stroke"));
+
+    if (viewport.isEmpty())
+    {
+        qWarning() << "invalid viewport size" << parser.value("viewport");
+        return 1;
+    }
+
+    if (parser.isSet("single"))
+    {
+        LoadConfig config;
+        QSize grid = parseSize(grids.value(0));
+        config.image = parser.value("image");
+        config.viewport = viewport;
+        config.rows = grid.width();
+        config.cols = grid.height();
+        config.strokeThickness = strokes.value(0).toInt();
+        return runSingle(config, useCache, seed);
+    }
+
+    QStringList images = splitValues(parser.values("image"));
+    QStringList synthetic = splitValues(parser.values("synthetic"));
+
+    if (images.isEmpty() && synthetic.isEmpty())
+    {
+        images = QString(LOADPIPELINE_DEFAULT_IMAGES).split(',');
+        synthetic = QString(LOADPIPELINE_DEFAULT_SYNTHETIC).split(',');
+    }
+    if (grids.isEmpty())
+        grids = QString(LOADPIPELINE_DEFAULT_GRIDS).split(',');
+    if (strokes.isEmpty())
+        strokes = QString(LOADPIPELINE_DEFAULT_STROKES).split(',');
+
+    // The bundled pictures can be given by their name
+    for (int i = 0; i < images.count(); i++)
+    {
+        if (!QFile::exists(images[i]) && QFile::exists(QString(PUZZLE_MASTER_PICS_DIR "/") + images[i]))
+            images[i] = QString(PUZZLE_MASTER_PICS_DIR "/") + images[i];
+    }
+
+    QTemporaryDir tempDir;
+
+    foreach (const QString &sizeStr, synthetic)
+    {
+        QSize size = parseSize(sizeStr);
+        QString path = size.isEmpty() ? QString() : createSyntheticImage(tempDir.path(), size);
+
+        if (path.isEmpty())
+            qWarning() << "could not create synthetic image" << sizeStr;
+        else
+            images << path;
+    }
+
+    QStringList options;
+    options << "--seed" << QString::number(seed);
+    if (useCache)
+        options << "--cache";
+
+    QJsonArray results;
+    int repeat = MAX(1, parser.value("repeat").toInt());
+
+    foreach (const QString &image, images)
+    {
+        foreach (const QString &gridStr, grids)
+        {
+            foreach (const QString &strokeStr, strokes)
+            {
+                LoadConfig config;
+                QSize grid = parseSize(gridStr);
+                config.image = image;
+                config.viewport = viewport;
+                config.rows = grid.width();
+                config.cols = grid.height();
+                config.strokeThickness = strokeStr.toInt();
+
+                for (int r = 0; r < repeat; r++)
+                {
+                    QJsonObject result = runInChild(config, options, parser.isSet("verbose"));
+                    result["run"] = r;
+                    results.append(result);
+                }
+            }
+        }
+    }
+
+    QJsonObject root;
+    root["seed"] = (qint64) seed;
+    root["cache"] = useCache;
+    root["idealThreadCount"] = QThread::idealThreadCount();
+    root["results"] = results;
+    QByteArray json = QJsonDocument(root).toJson();
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "could not open" << file.fileName();
+            return 1;
+        }
+
+        file.write(json);
+    }
+    else
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    return 0;
+}
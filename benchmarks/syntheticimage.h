@@ -0,0 +1,47 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef SYNTHETICIMAGE_H
+#define SYNTHETICIMAGE_H
+
+#include <QImage>
+#include <QString>
+
+// Saves a gradient with some noise on it, so that it compresses about as well as a photo.
+// NOTE: the noise only depends on the size, so every run of the benchmarks gets the same image
+inline bool saveSyntheticImage(const QString &path, const QSize &size)
+{
+    QImage image(size, QImage::Format_RGB32);
+    unsigned state = size.width() * 31 + size.height();
+
+    for (int y = 0; y < size.height(); y++)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+        for (int x = 0; x < size.width(); x++)
+        {
+            state = state * 1103515245 + 12345;
+            int noise = (state >> 16) & 0x1f;
+            line[x] = qRgb(x * 223 / size.width() + noise, y * 223 / size.height() + noise, ((x ^ y) & 0xff) * 223 / 255 + noise);
+        }
+    }
+
+    return image.save(path, "JPG", 90);
+}
+
+#endif // SYNTHETICIMAGE_H
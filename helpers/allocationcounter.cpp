@@ -0,0 +1,111 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include "allocationcounter.h"
+
+#ifdef PUZZLE_MASTER_COUNT_ALLOCATIONS
+
+#include <QAtomicInt>
+#include <cstdlib>
+#include <new>
+
+static QBasicAtomicInt allocationCount = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+#if defined(__GLIBC__)
+
+// The executable's definitions take precedence over the ones in libc,
+// so the allocations of Qt and of operator new go through these too
+extern "C"
+{
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+    allocationCount.fetchAndAddRelaxed(1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) __THROW
+{
+    allocationCount.fetchAndAddRelaxed(1);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+    allocationCount.fetchAndAddRelaxed(1);
+    return __libc_realloc(ptr, size);
+}
+
+}
+
+#else
+
+void *operator new(std::size_t size)
+{
+    allocationCount.fetchAndAddRelaxed(1);
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    std::free(p);
+}
+
+#endif
+
+bool AllocationCounter::isEnabled()
+{
+    return true;
+}
+
+qint64 AllocationCounter::count()
+{
+    // NOTE: this works with both the Qt 4 and the Qt 5 QAtomicInt API
+    return allocationCount.fetchAndAddRelaxed(0);
+}
+
+#else
+
+bool AllocationCounter::isEnabled()
+{
+    return false;
+}
+
+qint64 AllocationCounter::count()
+{
+    return 0;
+}
+
+#endif
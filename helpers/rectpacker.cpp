@@ -0,0 +1,117 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include "rectpacker.h"
+
+RectPacker::RectPacker(const QSize &size, int padding)
+    : _size(size)
+    , _padding(padding)
+{
+    clear();
+}
+
+void RectPacker::clear()
+{
+    Segment s = { 0, 0, _size.width() };
+    _skyline.clear();
+    _skyline.append(s);
+}
+
+// Returns the y coordinate where a rectangle of the given size can be put at
+// the left edge of the given segment, or -1 if it doesn't fit there
+int RectPacker::fit(int index, const QSize &size) const
+{
+    int x = _skyline[index].x;
+    if (x + size.width() > _size.width())
+        return -1;
+
+    int y = 0, widthLeft = size.width();
+    for (int i = index; widthLeft > 0; i++)
+    {
+        y = myMax(y, _skyline[i].y);
+        if (y + size.height() > _size.height())
+            return -1;
+        widthLeft -= _skyline[i].width;
+    }
+
+    return y;
+}
+
+// Finds a place for a rectangle of the given size, returns false if it doesn't fit anymore
+bool RectPacker::insert(const QSize &size0, QPoint *position)
+{
+    QSize size = size0 + QSize(_padding, _padding);
+    int bestIndex = -1, bestY = _size.height(), bestWidth = _size.width();
+
+    for (int i = 0; i < _skyline.count(); i++)
+    {
+        int y = fit(i, size);
+
+        // Choose the lowest place, and from those the narrowest segment
+        if (y >= 0 && (y < bestY || (y == bestY && _skyline[i].width < bestWidth)))
+        {
+            bestIndex = i;
+            bestY = y;
+            bestWidth = _skyline[i].width;
+        }
+    }
+
+    if (bestIndex < 0)
+        return false;
+
+    *position = QPoint(_skyline[bestIndex].x, bestY);
+
+    // Raise the skyline where the rectangle was put
+    Segment s = { position->x(), bestY + size.height(), size.width() };
+    _skyline.insert(bestIndex, s);
+
+    // Shrink or remove the segments which are now under the new one
+    int right = s.x + s.width;
+    for (int i = bestIndex + 1; i < _skyline.count(); )
+    {
+        Segment &next = _skyline[i];
+        if (next.x >= right)
+            break;
+
+        int shrink = right - next.x;
+        if (shrink < next.width)
+        {
+            next.x += shrink;
+            next.width -= shrink;
+            break;
+        }
+
+        _skyline.remove(i);
+    }
+
+    // Merge the neighbouring segments of the same height
+    for (int i = 0; i < _skyline.count() - 1; )
+    {
+        if (_skyline[i].y == _skyline[i + 1].y)
+        {
+            _skyline[i].width += _skyline[i + 1].width;
+            _skyline.remove(i + 1);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,53 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef RECTPACKER_H
+#define RECTPACKER_H
+
+#include <QSize>
+#include <QPoint>
+#include <QVector>
+
+#include "../helpers/util.h"
+
+// Packs rectangles into a bigger rectangle, eg. images into a texture atlas.
+// ----------
+// Uses the skyline bottom-left heuristic: the packer remembers the top edge of the
+// packed area (the skyline) and puts every new rectangle as low as it can.
+// The padding is left free to the right and bottom of every rectangle.
+// ----------
+class RectPacker
+{
+    struct Segment
+    {
+        int x, y, width;
+    };
+
+    GENPROPERTY_R(QSize, _size, size)
+    GENPROPERTY_R(int, _padding, padding)
+    QVector<Segment> _skyline;
+
+    int fit(int index, const QSize &size) const;
+
+public:
+    explicit RectPacker(const QSize &size = QSize(), int padding = 0);
+    bool insert(const QSize &size, QPoint *position);
+    void clear();
+};
+
+#endif // RECTPACKER_H
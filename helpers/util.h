@@ -23,6 +23,11 @@
 #define MIN(x, y) ((x < y) ? (x) : (y))
 #define MAX(x, y) ((x > y) ? (x) : (y))
 
+// SSE2 is available on every x86-64 CPU, on x86 only when the compiler is told so
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PUZZLE_MASTER_HAVE_SSE2
+#endif
+
 // Simple property
 #define GENPROPERTY_S(type, pname, name, settername) \
     private: type pname; \
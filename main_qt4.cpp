@@ -106,6 +106,7 @@ Q_DECL_EXPORT int main(int argc, char *argv[])
     qsrand((uint)QTime::currentTime().msec());
     qmlRegisterType<PuzzleBoardItem>("net.venemo.puzzlemaster", 2, 0, "PuzzleBoard");
     qmlRegisterUncreatableType<PuzzleGame>("net.venemo.puzzlemaster", 2, 0, "PuzzleGame", "This type should not be used from QML.");
+    qmlRegisterUncreatableType<PuzzleGameLoader>("net.venemo.puzzlemaster", 2, 0, "PuzzleGameLoader", "This type should not be used from QML.");
     qmlRegisterType<AppSettings>("net.venemo.puzzlemaster", 2, 0, "AppSettings");
 
     loadTranslations();
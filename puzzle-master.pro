@@ -18,26 +18,18 @@
 
 QT = core
 
+include(puzzle/puzzle.pri)
+
 SOURCES += \
     helpers/util.cpp \
     helpers/appsettings.cpp \
     helpers/appeventhandler.cpp \
-    puzzle/creation/shapeprocessor.cpp \
-    puzzle/creation/imageprocessor.cpp \
-    puzzle/puzzlepieceprimitive.cpp \
-    puzzle/puzzlepiece.cpp \
-    puzzle/puzzlegame.cpp
+    helpers/rectpacker.cpp
 
 HEADERS += \
-    helpers/util.h \
     helpers/appsettings.h \
     helpers/appeventhandler.h \
-    puzzle/creation/shapeprocessor.h \
-    puzzle/creation/imageprocessor.h \
-    puzzle/creation/helpertypes.h \
-    puzzle/puzzlepieceprimitive.h \
-    puzzle/puzzlepiece.h \
-    puzzle/puzzlegame.h
+    helpers/rectpacker.h
 
 lessThan(QT_MAJOR_VERSION, 5) {
     lessThan(QT_MAJOR_VERSION, 4) | lessThan(QT_MINOR_VERSION, 7) {
@@ -366,4 +358,18 @@ contains(DEFINES, HAVE_DEVICEINFO_CHECK) {
     MOBILITY += systeminfo
 }
 
+# Benchmarks
+
+# NOTE: the benchmarks are separate executables which are not built by default,
+#       run "make benchmarks" to build them next to the app.
+benchmarks.commands = \
+    $(CHK_DIR_EXISTS) benchmarks || $(MKDIR) benchmarks; \
+    cd benchmarks && $$QMAKE_QMAKE $$PWD/benchmarks/benchmarks.pro && $(MAKE)
+QMAKE_EXTRA_TARGETS += benchmarks
+
+OTHER_FILES += \
+    benchmarks/benchmarks.pro \
+    benchmarks/loadpipeline/loadpipeline.pro \
+    benchmarks/hotpaths/hotpaths.pro
+
 ANDROID_PACKAGE_SOURCE_DIR = $$PWD/android
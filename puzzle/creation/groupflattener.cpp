@@ -0,0 +1,180 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QPainter>
+#include <qmath.h>
+
+#include "groupflattener.h"
+#include "../../helpers/util.h"
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+class GroupFlattenerPrivate
+{
+    friend class GroupFlattener;
+    friend class FlattenWorker;
+
+    QVector<FlattenJob> jobs;
+    QVector<FlattenResult> results;
+    FlattenResult *resultData;
+    int runningWorkers;
+    QMutex doneMutex;
+    QWaitCondition doneCondition;
+
+    void runJob(int index);
+};
+
+class FlattenWorker : public QRunnable
+{
+    GroupFlattenerPrivate *_p;
+    int _job;
+
+public:
+    FlattenWorker(GroupFlattenerPrivate *p, int job) : _p(p), _job(job) { }
+    void run();
+};
+
+void GroupFlattenerPrivate::runJob(int index)
+{
+    const FlattenJob &job = jobs.at(index);
+    FlattenResult &result = resultData[index];
+
+    // Find the area which is covered by the layers
+    QRectF bounds;
+    foreach (const FlattenLayer &layer, job.layers)
+    {
+        bounds |= QRectF(layer.strokeOffset, layer.stroke.size());
+        bounds |= QRectF(layer.pixmapOffset, layer.pixmap.size());
+    }
+
+    result.offset = QPoint(qFloor(bounds.left()), qFloor(bounds.top()));
+    result.image = QImage(qCeil(bounds.right()) - result.offset.x(), qCeil(bounds.bottom()) - result.offset.y(), QImage::Format_ARGB32_Premultiplied);
+    result.image.fill(Qt::transparent);
+
+    // NOTE: the layers are put on whole pixels, so that the image and the hit mask match exactly
+    {
+        QPainter painter(&result.image);
+        foreach (const FlattenLayer &layer, job.layers)
+            painter.drawImage((layer.strokeOffset - result.offset).toPoint(), layer.stroke);
+        foreach (const FlattenLayer &layer, job.layers)
+            painter.drawImage((layer.pixmapOffset - result.offset).toPoint(), layer.pixmap);
+    }
+
+    // Merge the hit masks and the usability rects, relative to the new offset
+    QRect maskBounds;
+    foreach (const FlattenLayer &layer, job.layers)
+    {
+        QPointF delta = layer.pixmapOffset - result.offset;
+        maskBounds |= layer.hitMask.bounds.translated(delta.toPoint());
+        foreach (const QRectF &rect, layer.usabilityRects)
+            result.usabilityRects.append(rect.translated(delta));
+    }
+
+    result.hitMask.bounds = maskBounds;
+    result.hitMask.bits.resize(maskBounds.width() * maskBounds.height());
+
+    foreach (const FlattenLayer &layer, job.layers)
+    {
+        const HitMask &mask = layer.hitMask;
+        QPoint topLeft = mask.bounds.topLeft() + (layer.pixmapOffset - result.offset).toPoint() - maskBounds.topLeft();
+
+        for (int y = 0; y < mask.bounds.height(); y++)
+        {
+            int source = y * mask.bounds.width(),
+                target = (topLeft.y() + y) * maskBounds.width() + topLeft.x();
+
+            for (int x = 0; x < mask.bounds.width(); x++)
+                if (mask.bits.testBit(source + x))
+                    result.hitMask.bits.setBit(target + x);
+        }
+    }
+}
+
+void FlattenWorker::run()
+{
+    _p->runJob(_job);
+
+    QMutexLocker locker(&_p->doneMutex);
+    if (--_p->runningWorkers == 0)
+        _p->doneCondition.wakeAll();
+}
+
+GroupFlattener::GroupFlattener(const QVector<FlattenJob> &jobs)
+{
+    _p = new GroupFlattenerPrivate();
+    _p->jobs = jobs;
+    _p->results.resize(jobs.count());
+    _p->resultData = _p->results.data();
+    _p->runningWorkers = 0;
+}
+
+GroupFlattener::~GroupFlattener()
+{
+    // The workers use the private object, so they must finish first
+    waitForDone();
+    delete _p;
+}
+
+void GroupFlattener::start()
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    _p->runningWorkers = _p->jobs.count();
+
+    for (int i = 0; i < _p->jobs.count(); i++)
+        pool->start(new FlattenWorker(_p, i));
+}
+
+bool GroupFlattener::isFinished() const
+{
+    QMutexLocker locker(&_p->doneMutex);
+    return _p->runningWorkers == 0;
+}
+
+bool GroupFlattener::waitForDone(unsigned long msecs)
+{
+    QMutexLocker locker(&_p->doneMutex);
+
+    while (_p->runningWorkers > 0)
+    {
+        if (!_p->doneCondition.wait(&_p->doneMutex, msecs))
+            return false;
+    }
+
+    return true;
+}
+
+const QVector<FlattenJob> &GroupFlattener::jobs() const
+{
+    return _p->jobs;
+}
+
+const QVector<FlattenResult> &GroupFlattener::results() const
+{
+    return _p->results;
+}
+
+}
+}
@@ -0,0 +1,90 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef GROUPFLATTENER_H
+#define GROUPFLATTENER_H
+
+#include <QImage>
+#include <QVector>
+#include <QPointF>
+#include <QRectF>
+#include <climits>
+#include "maskrasterizer.h"
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+// One primitive of a merged group, in the coordinates of the group
+// NOTE: the images are copied out of the pixmaps on the GUI thread, because QPixmap can't be used on other threads
+struct FlattenLayer
+{
+    QImage stroke, pixmap;
+    QPointF strokeOffset, pixmapOffset;
+    HitMask hitMask;
+    QVector<QRectF> usabilityRects;
+};
+
+// Everything that is needed to flatten a merged group.
+// The version is the primitives version of the piece when the job was created,
+// the result is only usable if the piece hasn't changed since.
+struct FlattenJob
+{
+    int piece, version;
+    QVector<FlattenLayer> layers;
+};
+
+// The output of a FlattenJob: a single primitive which looks the same as the layers together.
+// offset - the pixmap offset of the new primitive, the hit mask and the usability rects are relative to it
+// NOTE: the usability rects of the layers are kept, their union would cover the gaps of an L shaped group too
+struct FlattenResult
+{
+    QImage image;
+    QPoint offset;
+    HitMask hitMask;
+    QVector<QRectF> usabilityRects;
+};
+
+class GroupFlattenerPrivate;
+
+// Composites the primitives of merged groups into one image and one hit mask per group.
+// ----------
+// Every group is flattened on the thread pool, the strokes are painted first and then the
+// pieces, the same way as the board draws them. The results are stored in the same order
+// as the jobs and they can be used when isFinished() returns true.
+// ----------
+class GroupFlattener
+{
+    GroupFlattenerPrivate *_p;
+
+public:
+    explicit GroupFlattener(const QVector<FlattenJob> &jobs);
+    ~GroupFlattener();
+
+    void start();
+    bool isFinished() const;
+    bool waitForDone(unsigned long msecs = ULONG_MAX);
+    const QVector<FlattenJob> &jobs() const;
+    const QVector<FlattenResult> &results() const;
+};
+
+}
+}
+
+#endif // GROUPFLATTENER_H
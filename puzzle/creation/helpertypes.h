@@ -19,6 +19,8 @@
 #ifndef HELPERTYPES_H
 #define HELPERTYPES_H
 
+#include <QSize>
+
 namespace Puzzle
 {
 namespace Creation
@@ -16,8 +16,10 @@
 //
 // Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
 
-#include <QPainter>
+#include <QImageReader>
+#include <QTransform>
 #include "imageprocessor.h"
+#include "imageresampler.h"
 #include "../../helpers/util.h"
 
 namespace Puzzle
@@ -25,63 +27,174 @@ namespace Puzzle
 namespace Creation
 {
 
-
 class ImageProcessorPrivate
 {
     friend class ImageProcessor;
-    QPixmap pixmap;
+    QImage image;
     GameDescriptor descriptor;
-    QPixmap processImage(const QString &url, int width, int height);
+    QImage processImage(const QString &url, int width, int height);
 };
 
-QPixmap ImageProcessorPrivate::processImage(const QString &url, int width, int height)
+// The EXIF orientation of the image, as a combination of QImageIOHandler::Transformation flags
+#define IMAGEPROCESSOR_MIRROR 1
+#define IMAGEPROCESSOR_FLIP 2
+#define IMAGEPROCESSOR_ROTATE90 4
+
+// The reader is asked to scale the image down to at most 1/8 of its size
+#define IMAGEPROCESSOR_MAX_DECODE_SHIFT 3
+
+// Maps a rectangle of the oriented image back to the image as it is stored in the file.
+// This is the inverse of what QImageReader does with auto transform: mirror, flip, then rotate by 90 degrees.
+static QRect mapFromOriented(const QRect &r, int transformation, const QSize &storedSize)
+{
+    QRect result = r;
+
+    if (transformation & IMAGEPROCESSOR_ROTATE90)
+        result = QRect(r.top(), storedSize.height() - r.left() - r.width(), r.height(), r.width());
+    if (transformation & IMAGEPROCESSOR_FLIP)
+        result.moveTop(storedSize.height() - result.top() - result.height());
+    if (transformation & IMAGEPROCESSOR_MIRROR)
+        result.moveLeft(storedSize.width() - result.left() - result.width());
+
+    return result;
+}
+
+// Maps a rectangle of the image as it is stored in the file to the oriented image
+static QRect mapToOriented(const QRect &r, int transformation, const QSize &storedSize)
 {
-    QPixmap pix(url);
+    QRect result = r;
+
+    if (transformation & IMAGEPROCESSOR_MIRROR)
+        result.moveLeft(storedSize.width() - result.left() - result.width());
+    if (transformation & IMAGEPROCESSOR_FLIP)
+        result.moveTop(storedSize.height() - result.top() - result.height());
+    if (transformation & IMAGEPROCESSOR_ROTATE90)
+        result = QRect(storedSize.height() - result.top() - result.height(), result.left(), result.height(), result.width());
 
-    if (pix.isNull())
-        return pix;
+    return result;
+}
+
+// NOTE: this works with QImage instead of QPixmap, because the pieces
+//       are painted from this image on worker threads (see PieceGenerator)
+QImage ImageProcessorPrivate::processImage(const QString &url, int width, int height)
+{
+    QImageReader reader(url);
+    QImage decoded;
+    int transformation = 0;
 
-    // If the image is better displayed in "portrait mode", rotate it.
-    if ((pix.width() < pix.height() && width >= height) || (pix.width() >= pix.height() && width < height))
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    reader.setAutoTransform(true);
+    transformation = (int) reader.transformation();
+#endif
+
+    // The size of the image as it is stored, and as it is displayed
+    QSize storedSize = reader.size();
+    QSize size = (transformation & IMAGEPROCESSOR_ROTATE90) ? QSize(storedSize.height(), storedSize.width()) : storedSize;
+
+    // Some formats can't tell the size without decoding the whole image
+    if (!size.isValid())
     {
-        pix = pix.scaledToHeight(width);
-        QPixmap pix2(pix.height(), pix.width());
-        QPainter p;
-        p.begin(&pix2);
-        p.rotate(-90);
-        p.translate(- pix2.height(), 0);
-        p.drawPixmap(0, 0, pix);
-        p.end();
-        pix = pix2;
+        decoded = reader.read();
+
+        if (decoded.isNull())
+            return decoded;
+
+        size = decoded.size();
     }
 
-    // Scale it to our width
-    if (pix.width() - 1 > width || pix.width() + 1 < width)
-        pix = pix.scaledToWidth(width);
+    // If the image is better displayed in "portrait mode", it is rotated.
+    // Otherwise it is scaled to our width, and if still not good enough, cropped.
+    bool rotate = (size.width() < size.height() && width >= height) || (size.width() >= size.height() && width < height);
+    QSize scaledSize;
+    QRect clip;
 
-    // If still not good enough, just crop it
-    if (pix.height() > height)
+    if (rotate)
     {
-        QPixmap pix2(width, height);
-        QPainter p;
-        p.begin(&pix2);
-        p.drawPixmap(0, 0, pix, 0, (pix.height() - height) / 2, pix.width(), pix.height());
-        p.end();
-        pix = pix2;
+        // The image is scaled to the width of the viewport, then rotated,
+        // so its columns will be the rows of the result.
+        scaledSize = QSize(qRound((qreal) size.width() * width / size.height()), width);
+        int crop = MAX(0, (scaledSize.width() - height) / 2);
+        clip = QRect(scaledSize.width() - crop - MIN(height, scaledSize.width()), 0, MIN(height, scaledSize.width()), width);
     }
+    else
+    {
+        if (size.width() - 1 > width || size.width() + 1 < width)
+            scaledSize = QSize(width, qRound((qreal) size.height() * width / size.width()));
+        else
+            scaledSize = size;
+
+        int crop = MAX(0, (scaledSize.height() - height) / 2);
+        clip = QRect(0, crop, MIN(width, scaledSize.width()), MIN(height, scaledSize.height()));
+    }
+
+    qreal   fx = (qreal) size.width() / scaledSize.width(),
+            fy = (qreal) size.height() / scaledSize.height();
+    QRect region(QPoint(0, 0), size);
+
+    if (decoded.isNull())
+    {
+        // Only decode the visible part of the image (plus a pixel for the interpolation)
+        region = QRectF(clip.x() * fx, clip.y() * fy, clip.width() * fx, clip.height() * fy).toAlignedRect().adjusted(-1, -1, 1, 1) & region;
+
+        // Let the reader scale it down, but not below the size of the result
+        int shift = 0;
 
-    return pix;
+        if (reader.supportsOption(QImageIOHandler::ScaledSize))
+        {
+            while (shift < IMAGEPROCESSOR_MAX_DECODE_SHIFT && (2 << shift) <= MIN(fx, fy))
+                shift++;
+        }
+
+        // Align the region to the blocks which are scaled together
+        int block = 1 << shift;
+        QRect stored = mapFromOriented(region, transformation, storedSize);
+        stored.setCoords(stored.left() / block * block, stored.top() / block * block,
+                         (stored.right() / block + 1) * block - 1, (stored.bottom() / block + 1) * block - 1);
+        stored &= QRect(QPoint(0, 0), storedSize);
+        region = mapToOriented(stored, transformation, storedSize);
+
+        reader.setClipRect(stored);
+
+        if (shift)
+        {
+            reader.setScaledSize(QSize((stored.width() + block - 1) >> shift, (stored.height() + block - 1) >> shift));
+        }
+
+        decoded = reader.read();
+
+        if (decoded.isNull())
+            return decoded;
+    }
+
+    if (decoded.format() != QImage::Format_RGB32 && decoded.format() != QImage::Format_ARGB32_Premultiplied)
+        decoded = decoded.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    // Map the pixels of the result to the scaled (and rotated) image...
+    QTransform transform;
+
+    if (rotate)
+        transform = QTransform(0, 1, -1, 0, clip.x() + clip.width(), clip.y());
+    else
+        transform = QTransform::fromTranslate(clip.x(), clip.y());
+
+    // ...then to the original image, then to the part that was decoded
+    transform *= QTransform::fromScale(fx, fy);
+    transform *= QTransform::fromTranslate(-region.x(), -region.y());
+    transform *= QTransform::fromScale((qreal) decoded.width() / region.width(), (qreal) decoded.height() / region.height());
+
+    // Scale, rotate and crop it in one go
+    return resampleImage(decoded, transform, rotate ? QSize(clip.height(), clip.width()) : clip.size());
 }
 
 ImageProcessor::ImageProcessor(const QString &url, const QSize &viewportSize, int rows, int cols, int strokeThickness)
 {
     _p = new ImageProcessorPrivate();
-    _p->pixmap = _p->processImage(url, viewportSize.width(), viewportSize.height());
+    _p->image = _p->processImage(url, viewportSize.width(), viewportSize.height());
     _p->descriptor.rows = rows;
     _p->descriptor.cols = cols;
     _p->descriptor.viewportSize = viewportSize;
-    _p->descriptor.pixmapSize = _p->pixmap.size();
-    _p->descriptor.unitSize = QSize(_p->pixmap.width() / cols, _p->pixmap.height() / rows);
+    _p->descriptor.pixmapSize = _p->image.size();
+    _p->descriptor.unitSize = QSize(_p->image.width() / cols, _p->image.height() / rows);
     _p->descriptor.tabSize = MIN(_p->descriptor.unitSize.width() / 6.0, _p->descriptor.unitSize.height() / 6.0);
     _p->descriptor.tabOffset = _p->descriptor.tabSize * 0.55;
     _p->descriptor.tabTolerance = 1;
@@ -95,54 +208,65 @@ ImageProcessor::~ImageProcessor()
     delete _p;
 }
 
-bool ImageProcessor::isValid()
+bool ImageProcessor::isValid() const
 {
-    return !_p->pixmap.isNull();
+    return !_p->image.isNull();
 }
 
-const GameDescriptor &ImageProcessor::descriptor()
+const GameDescriptor &ImageProcessor::descriptor() const
 {
     return _p->descriptor;
 }
 
-QPixmap ImageProcessor::drawPiece(int i, int j, const QPainterPath &shape, const Puzzle::Creation::Correction &corr)
+// NOTE: drawPiece only reads the state of the ImageProcessor and drawStroke doesn't use it at all,
+//       so it is safe to call them from multiple threads at the same time.
+
+QImage ImageProcessor::drawPiece(int i, int j, const CoverageMask &mask, const Puzzle::Creation::Correction &corr) const
 {
-    QPainter p;
-    QPixmap px(_p->descriptor.unitSize.width() + corr.widthCorrection + 1,
-               _p->descriptor.unitSize.height() + corr.heightCorrection + 1);
-    px.fill(Qt::transparent);
-
-    p.begin(&px);
-    p.setRenderHint(QPainter::SmoothPixmapTransform);
-    p.setRenderHint(QPainter::Antialiasing);
-    p.setRenderHint(QPainter::HighQualityAntialiasing);
-    p.setClipping(true);
-    p.setClipPath(shape);
-
-    p.drawPixmap(_p->descriptor.tabFull + corr.xCorrection + corr.sxCorrection,
-                 _p->descriptor.tabFull + corr.yCorrection + corr.syCorrection,
-                 _p->pixmap,
-                 i * _p->descriptor.unitSize.width() + corr.sxCorrection,
-                 j * _p->descriptor.unitSize.height() + corr.syCorrection,
-                 _p->descriptor.unitSize.width() * 2,
-                 _p->descriptor.unitSize.height() * 2);
-
-    p.end();
+    QImage px(mask.width, mask.height, QImage::Format_ARGB32_Premultiplied);
+    px.fill(0);
+
+    // The region of the image which contains the piece
+    // NOTE: the corrections always put the top left corner of the region into the top left corner of the piece
+    int sx = i * _p->descriptor.unitSize.width() + corr.sxCorrection,
+        sy = j * _p->descriptor.unitSize.height() + corr.syCorrection,
+        x0 = _p->descriptor.tabFull + corr.xCorrection + corr.sxCorrection,
+        y0 = _p->descriptor.tabFull + corr.yCorrection + corr.syCorrection,
+        w = MIN(_p->descriptor.unitSize.width() * 2, px.width() - x0),
+        h = MIN(_p->descriptor.unitSize.height() * 2, px.height() - y0);
+
+    // Clip it to the image
+    if (sx < 0)
+        w += sx, x0 -= sx, sx = 0;
+    if (sy < 0)
+        h += sy, y0 -= sy, sy = 0;
+    w = MIN(w, _p->image.width() - sx);
+    h = MIN(h, _p->image.height() - sy);
+
+    // Copy it and cut out the shape of the piece in one go
+    for (int y = 0; y < h; y++)
+    {
+        multiplyByMask(reinterpret_cast<QRgb*>(px.scanLine(y0 + y)) + x0,
+                       reinterpret_cast<const QRgb*>(_p->image.constScanLine(sy + y)) + sx,
+                       mask.scanLine(y0 + y) + x0, w);
+    }
+
     return px;
 }
 
-QPixmap ImageProcessor::drawStroke(const QPainterPath &strokeShape, const QSize &pxSize)
+QImage ImageProcessor::drawStroke(const CoverageMask &strokeMask)
 {
-    QPainter p;
-    QPixmap stroke(pxSize.width() + _p->descriptor.strokeThickness * 2,
-                   pxSize.height() + _p->descriptor.strokeThickness * 2);
-    stroke.fill(Qt::transparent);
-    p.begin(&stroke);
-    p.setRenderHint(QPainter::SmoothPixmapTransform, true);
-    p.setRenderHint(QPainter::Antialiasing, true);
-    p.setRenderHint(QPainter::HighQualityAntialiasing, true);
-    p.fillPath(strokeShape, QBrush(QColor(255, 255, 255, 255)));
-    p.end();
+    QImage stroke(strokeMask.width, strokeMask.height, QImage::Format_ARGB32_Premultiplied);
+
+    // The stroke is white, so every channel of the premultiplied pixel is the coverage
+    for (int y = 0; y < stroke.height(); y++)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(stroke.scanLine(y));
+        const uchar *coverage = strokeMask.scanLine(y);
+
+        for (int x = 0; x < stroke.width(); x++)
+            line[x] = coverage[x] * 0x01010101u;
+    }
 
     return stroke;
 }
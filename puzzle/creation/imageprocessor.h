@@ -20,8 +20,9 @@
 #define IMAGEPROCESSOR_H
 
 #include <QString>
-#include <QPixmap>
+#include <QImage>
 #include "helpertypes.h"
+#include "maskrasterizer.h"
 
 namespace Puzzle
 {
@@ -38,10 +39,10 @@ public:
     explicit ImageProcessor(const QString &url, const QSize &viewportSize, int rows, int cols, int strokeThickness);
     ~ImageProcessor();
 
-    bool isValid();
-    const GameDescriptor &descriptor();
-    QPixmap drawPiece(int i, int j, const QPainterPath &shape, const Puzzle::Creation::Correction &corr);
-    QPixmap drawStroke(const QPainterPath &strokeShape, const QSize &pxSize);
+    bool isValid() const;
+    const GameDescriptor &descriptor() const;
+    QImage drawPiece(int i, int j, const CoverageMask &mask, const Puzzle::Creation::Correction &corr) const;
+    static QImage drawStroke(const CoverageMask &strokeMask);
 
 };
 
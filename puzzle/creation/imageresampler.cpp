@@ -0,0 +1,171 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <cmath>
+
+#include "imageresampler.h"
+#include "../../helpers/util.h"
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+// Weighted sum of two pixels, a + b must be 256
+static inline uint interpolatePixel(uint x, uint a, uint y, uint b)
+{
+    uint t = (x & 0xff00ff) * a + (y & 0xff00ff) * b;
+    t >>= 8;
+    t &= 0xff00ff;
+
+    x = ((x >> 8) & 0xff00ff) * a + ((y >> 8) & 0xff00ff) * b;
+    x &= 0xff00ff00;
+
+    return x | t;
+}
+
+// Bilinear interpolation of four pixels, distx and disty are between 0 and 255
+static inline uint interpolate4Pixels(uint tl, uint tr, uint bl, uint br, uint distx, uint disty)
+{
+    uint left = interpolatePixel(tl, 256 - disty, bl, disty);
+    uint right = interpolatePixel(tr, 256 - disty, br, disty);
+    return interpolatePixel(left, 256 - distx, right, distx);
+}
+
+// Average of four pixels
+static inline uint averagePixels(uint a, uint b, uint c, uint d)
+{
+    uint rb = (a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff) + 0x20002;
+    uint ag = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff) + 0x20002;
+    return ((rb >> 2) & 0xff00ff) | ((ag << 6) & 0xff00ff00);
+}
+
+// Halves the size of an image, every pixel of the result is the average of four source pixels
+static QImage halveImage(const QImage &source)
+{
+    int sw = source.width(), sh = source.height();
+    QImage result(MAX(1, sw / 2), MAX(1, sh / 2), QImage::Format_ARGB32_Premultiplied);
+
+    for (int y = 0; y < result.height(); y++)
+    {
+        const QRgb *line0 = reinterpret_cast<const QRgb*>(source.constScanLine(MIN(y * 2, sh - 1)));
+        const QRgb *line1 = reinterpret_cast<const QRgb*>(source.constScanLine(MIN(y * 2 + 1, sh - 1)));
+        QRgb *dst = reinterpret_cast<QRgb*>(result.scanLine(y));
+        int x = 0;
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+        const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+
+        // Two pixels of the result from four pixels of both lines
+        for (; x + 2 <= result.width() && sw >= 4; x += 2)
+        {
+            __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line0 + x * 2));
+            __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line1 + x * 2));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(p1, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(p1, zero));
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(sum, sum));
+        }
+#endif
+
+        for (; x < result.width(); x++)
+        {
+            int x0 = MIN(x * 2, sw - 1), x1 = MIN(x * 2 + 1, sw - 1);
+            dst[x] = averagePixels(line0[x0], line0[x1], line1[x0], line1[x1]);
+        }
+    }
+
+    return result;
+}
+
+QImage resampleImage(const QImage &source, const QTransform &transform, const QSize &size)
+{
+    QImage src = source;
+    QTransform tr = transform;
+
+    // How many source pixels are there for one pixel of the result
+    qreal ratio = myMax<qreal>(sqrt(tr.m11() * tr.m11() + tr.m12() * tr.m12()), sqrt(tr.m21() * tr.m21() + tr.m22() * tr.m22()));
+
+    while (ratio > 2 && src.width() > 1 && src.height() > 1)
+    {
+        src = halveImage(src);
+        tr *= QTransform::fromScale(0.5, 0.5);
+        ratio /= 2;
+    }
+
+    QImage result(size, QImage::Format_ARGB32_Premultiplied);
+    int sw = src.width(), sh = src.height();
+
+    // The coordinates are fixed point numbers with 16 fractional bits
+    int dfx = qRound(tr.m11() * 65536), dfy = qRound(tr.m12() * 65536);
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+#endif
+
+    for (int y = 0; y < size.height(); y++)
+    {
+        // The center of the first pixel of this line, in the source
+        QPointF start = tr.map(QPointF(0.5, y + 0.5)) - QPointF(0.5, 0.5);
+        int fx = qRound(start.x() * 65536), fy = qRound(start.y() * 65536);
+        QRgb *dst = reinterpret_cast<QRgb*>(result.scanLine(y));
+
+        for (int x = 0; x < size.width(); x++, fx += dfx, fy += dfy)
+        {
+            int px = fx >> 16, py = fy >> 16;
+            uint distx = (fx >> 8) & 0xff, disty = (fy >> 8) & 0xff;
+
+            if (px < 0 || py < 0 || px >= sw - 1 || py >= sh - 1)
+            {
+                // Near the edges, the edge pixels are repeated
+                int x0 = CLAMP(px, 0, sw - 1), x1 = CLAMP(px + 1, 0, sw - 1),
+                    y0 = CLAMP(py, 0, sh - 1), y1 = CLAMP(py + 1, 0, sh - 1);
+                const QRgb *line0 = reinterpret_cast<const QRgb*>(src.constScanLine(y0));
+                const QRgb *line1 = reinterpret_cast<const QRgb*>(src.constScanLine(y1));
+                dst[x] = interpolate4Pixels(line0[x0], line0[x1], line1[x0], line1[x1], distx, disty);
+                continue;
+            }
+
+            const QRgb *line0 = reinterpret_cast<const QRgb*>(src.constScanLine(py)) + px;
+            const QRgb *line1 = reinterpret_cast<const QRgb*>(src.constScanLine(py + 1)) + px;
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+            // Same arithmetic as interpolate4Pixels, one channel in every 16-bit lane
+            __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(line0)), zero);
+            __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(line1)), zero);
+            __m128i v = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(256 - disty)), _mm_mullo_epi16(bottom, _mm_set1_epi16(disty)));
+            v = _mm_srli_epi16(v, 8);
+            v = _mm_mullo_epi16(v, _mm_set_epi16(distx, distx, distx, distx, 256 - distx, 256 - distx, 256 - distx, 256 - distx));
+            v = _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_si128(v, 8)), 8);
+            dst[x] = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+#else
+            dst[x] = interpolate4Pixels(line0[0], line0[1], line1[0], line1[1], distx, disty);
+#endif
+        }
+    }
+
+    return result;
+}
+
+}
+}
@@ -0,0 +1,43 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef IMAGERESAMPLER_H
+#define IMAGERESAMPLER_H
+
+#include <QImage>
+#include <QTransform>
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+// Scales, rotates and crops an image in a single pass.
+// ----------
+// transform - maps the coordinates of the result to the coordinates of the source
+// size - the size of the result
+// The source must be Format_RGB32 or Format_ARGB32_Premultiplied, the result is Format_ARGB32_Premultiplied.
+// Every pixel of the result is interpolated bilinearly (with SSE2 when available).
+// If the source is more than twice as big as the result, it is halved with a box filter
+// first, so that no source pixels are skipped.
+// ----------
+QImage resampleImage(const QImage &source, const QTransform &transform, const QSize &size);
+
+}
+}
+
+#endif // IMAGERESAMPLER_H
@@ -0,0 +1,334 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <cmath>
+#include <cstring>
+
+#include "maskrasterizer.h"
+#include "../../helpers/util.h"
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+struct MaskCircle
+{
+    float cx, cy, r, dy2;
+    bool subtract;
+};
+
+// Multiplies every channel of a premultiplied pixel by a / 255
+static inline QRgb multiplyPixel(QRgb p, uint a)
+{
+    uint t = (p & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+
+    p = ((p >> 8) & 0xff00ff) * a;
+    p = (p + ((p >> 8) & 0xff00ff) + 0x800080);
+    p &= 0xff00ff00;
+
+    return p | t;
+}
+
+static inline float coverageOf(float d)
+{
+    float c = 0.5f - d;
+    return c < 0 ? 0 : (c > 1 ? 1 : c);
+}
+
+// Computes the coverage of a single scanline.
+// ----------
+// x0, x1 - horizontal edges of the rectangle
+// dyRect - vertical distance of the scanline from the rectangle
+// circles - tabs (united) and blanks (subtracted) which intersect this scanline, in order
+// ----------
+static void rasterizeScanLine(uchar *line, int width, float x0, float x1, float dyRect, const MaskCircle *circles, int circleCount)
+{
+    int x = 0;
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f), scale = _mm_set1_ps(255.0f), step = _mm_set1_ps(4.0f);
+    const __m128 vx0 = _mm_set1_ps(x0), vx1 = _mm_set1_ps(x1), vdy = _mm_set1_ps(dyRect);
+    __m128 px = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+    for (; x + 4 <= width; x += 4, px = _mm_add_ps(px, step))
+    {
+        __m128 d = _mm_max_ps(vdy, _mm_max_ps(_mm_sub_ps(vx0, px), _mm_sub_ps(px, vx1)));
+
+        for (int c = 0; c < circleCount; c++)
+        {
+            __m128 dx = _mm_sub_ps(px, _mm_set1_ps(circles[c].cx));
+            __m128 dc = _mm_sub_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(circles[c].dy2))), _mm_set1_ps(circles[c].r));
+            d = circles[c].subtract ? _mm_max_ps(d, _mm_sub_ps(zero, dc)) : _mm_min_ps(d, dc);
+        }
+
+        __m128 cov = _mm_min_ps(one, _mm_max_ps(zero, _mm_sub_ps(half, d)));
+        __m128i v = _mm_cvtps_epi32(_mm_mul_ps(cov, scale));
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        int packed = _mm_cvtsi128_si32(v);
+        memcpy(line + x, &packed, 4);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        float px = x + 0.5f;
+        float d = myMax<float>(dyRect, myMax<float>(x0 - px, px - x1));
+
+        for (int c = 0; c < circleCount; c++)
+        {
+            float dx = px - circles[c].cx;
+            float dc = sqrtf(dx * dx + circles[c].dy2) - circles[c].r;
+            d = circles[c].subtract ? myMax<float>(d, -dc) : myMin<float>(d, dc);
+        }
+
+        line[x] = (uchar)(coverageOf(d) * 255.0f + 0.5f);
+    }
+}
+
+CoverageMask rasterizeShape(const ShapeGeometry &g, const QSize &size, const QPointF &offset)
+{
+    CoverageMask mask;
+    mask.width = size.width();
+    mask.height = size.height();
+    mask.data.resize(mask.width * mask.height);
+
+    // The rectangle, see createPuzzleShape
+    float   x0 = g.tabFull - 1 + offset.x(),
+            y0 = g.tabFull - 1 + offset.y(),
+            x1 = x0 + g.unit.width() + 1,
+            y1 = y0 + g.unit.height() + 1;
+
+    // The tabs and blanks, in the same order as createPuzzleShape applies them
+    MaskCircle circles[4];
+    int circleCount = 0;
+    float   tabRadius = g.tabSize + g.tabTolerance,
+            midX = g.tabFull + g.unit.width() / 2.0f + offset.x(),
+            midY = g.tabFull + g.unit.height() / 2.0f + offset.y(),
+            left = offset.x(),
+            top = offset.y(),
+            right = g.tabFull + g.unit.width() + offset.x(),
+            bottom = g.tabFull + g.unit.height() + offset.y();
+
+#define ADD_CIRCLE(x, y, radius, sub) { MaskCircle &c = circles[circleCount++]; c.cx = (x); c.cy = (y); c.r = (radius); c.subtract = (sub); }
+
+    // Left
+    if (g.status & LeftBlank)
+        ADD_CIRCLE(left + g.tabFull + g.blankOffset, midY, g.blankSize, true)
+    else if (g.status & LeftTab)
+        ADD_CIRCLE(left + tabRadius, midY, tabRadius, false)
+
+    // Top
+    if (g.status & TopBlank)
+        ADD_CIRCLE(midX, top + g.tabFull + g.blankOffset, g.blankSize, true)
+    else if (g.status & TopTab)
+        ADD_CIRCLE(midX, top + tabRadius, tabRadius, false)
+
+    // Right
+    if (g.status & RightTab)
+        ADD_CIRCLE(right + g.tabOffset, midY, tabRadius, false)
+    else if (g.status & RightBlank)
+        ADD_CIRCLE(right - g.blankOffset, midY, g.blankSize, true)
+
+    // Bottom
+    if (g.status & BottomTab)
+        ADD_CIRCLE(midX, bottom + g.tabOffset, tabRadius, false)
+    else if (g.status & BottomBlank)
+        ADD_CIRCLE(midX, bottom - g.blankOffset, g.blankSize, true)
+
+#undef ADD_CIRCLE
+
+    for (int y = 0; y < mask.height; y++)
+    {
+        float py = y + 0.5f;
+        uchar *line = reinterpret_cast<uchar*>(mask.data.data()) + y * mask.width;
+
+        // Only those circles matter which are less than half a pixel away from this scanline
+        MaskCircle active[4];
+        int activeCount = 0;
+
+        for (int c = 0; c < circleCount; c++)
+        {
+            float dy = py - circles[c].cy;
+
+            if (fabsf(dy) <= circles[c].r + 0.5f)
+            {
+                active[activeCount] = circles[c];
+                active[activeCount].dy2 = dy * dy;
+                activeCount++;
+            }
+        }
+
+        float dyRect = myMax<float>(y0 - py, py - y1);
+
+        if (activeCount == 0 && dyRect >= 0.5f)
+            memset(line, 0, mask.width);
+        else
+            rasterizeScanLine(line, mask.width, x0, x1, dyRect, active, activeCount);
+    }
+
+    return mask;
+}
+
+CoverageMask transformMask(const CoverageMask &source, MatchMode flip, const QSize &size, const QPoint &offset)
+{
+    CoverageMask mask;
+    mask.width = size.width();
+    mask.height = size.height();
+    mask.data.fill(0, mask.width * mask.height);
+
+    bool    flipH = flip == HorizontalFlipMatch || flip == HorizontalAndVerticalFlipMatch,
+            flipV = flip == VerticalFlipMatch || flip == HorizontalAndVerticalFlipMatch;
+
+    // The columns which are inside the source
+    int x0 = MAX(0, -offset.x()), x1 = MIN(mask.width, source.width - offset.x());
+
+    for (int y = 0; y < mask.height && x0 < x1; y++)
+    {
+        int sy = y + offset.y();
+
+        if (sy < 0 || sy >= source.height)
+            continue;
+
+        const uchar *src = source.scanLine(flipV ? source.height - 1 - sy : sy);
+        uchar *line = reinterpret_cast<uchar*>(mask.data.data()) + y * mask.width;
+
+        if (flipH)
+        {
+            for (int x = x0; x < x1; x++)
+                line[x] = src[source.width - 1 - x - offset.x()];
+        }
+        else
+        {
+            memcpy(line + x0, src + x0 + offset.x(), x1 - x0);
+        }
+    }
+
+    return mask;
+}
+
+QRect maskBounds(const CoverageMask &mask)
+{
+    int x0 = mask.width, x1 = -1, y0 = mask.height, y1 = -1;
+
+    for (int y = 0; y < mask.height; y++)
+    {
+        const uchar *line = mask.scanLine(y);
+        int first = 0, last = mask.width - 1;
+
+        while (first <= last && !line[first])
+            first++;
+        if (first > last)
+            continue;
+        while (!line[last])
+            last--;
+
+        x0 = MIN(x0, first);
+        x1 = MAX(x1, last);
+        y0 = MIN(y0, y);
+        y1 = y;
+    }
+
+    if (x1 < 0)
+        return QRect();
+
+    return QRect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+HitMask createHitMask(const QRect &rect, const CoverageMask &mask, const QPoint &maskOffset)
+{
+    HitMask result;
+    result.bounds = rect | QRect(maskOffset, QSize(mask.width, mask.height));
+    result.bits.resize(result.bounds.width() * result.bounds.height());
+
+    int w = result.bounds.width();
+    QPoint r = rect.topLeft() - result.bounds.topLeft(), m = maskOffset - result.bounds.topLeft();
+
+    for (int y = 0; y < rect.height(); y++)
+        result.bits.fill(true, (r.y() + y) * w + r.x(), (r.y() + y) * w + r.x() + rect.width());
+
+    for (int y = 0; y < mask.height; y++)
+    {
+        const uchar *line = mask.scanLine(y);
+
+        for (int x = 0; x < mask.width; x++)
+        {
+            if (line[x] >= 128)
+                result.bits.setBit((m.y() + y) * w + m.x() + x);
+        }
+    }
+
+    return result;
+}
+
+void multiplyByMask(QRgb *dst, const QRgb *src, const uchar *mask, int count)
+{
+    int x = 0;
+
+#if defined(PUZZLE_MASTER_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16(0x80);
+
+    for (; x + 4 <= count; x += 4)
+    {
+        int m;
+        memcpy(&m, mask + x, 4);
+
+        // Most of a piece is either fully inside or fully outside of the shape
+        if (m == 0)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), zero);
+            continue;
+        }
+
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+
+        if (m == -1)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), p);
+            continue;
+        }
+
+        // Spread the coverage of every pixel to its 4 channels
+        __m128i a = _mm_cvtsi32_si128(m);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+
+        __m128i aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+        __m128i pLo = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), aLo),
+                pHi = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), aHi);
+
+        // Same rounding as multiplyPixel: (t + (t >> 8) + 0x80) >> 8
+        pLo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pLo, _mm_srli_epi16(pLo, 8)), half), 8);
+        pHi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pHi, _mm_srli_epi16(pHi, 8)), half), 8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(pLo, pHi));
+    }
+#endif
+
+    for (; x < count; x++)
+        dst[x] = multiplyPixel(src[x], mask[x]);
+}
+
+}
+}
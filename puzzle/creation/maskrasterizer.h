@@ -0,0 +1,94 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef MASKRASTERIZER_H
+#define MASKRASTERIZER_H
+
+#include <QSize>
+#include <QPointF>
+#include <QRect>
+#include <QByteArray>
+#include <QBitArray>
+#include <QRgb>
+#include "helpertypes.h"
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+// The parameters of a puzzle piece shape, see createPuzzleShape in shapeprocessor.cpp
+struct ShapeGeometry
+{
+    QSize unit;
+    int status;
+    qreal tabFull, tabSize, tabOffset, tabTolerance, blankSize, blankOffset;
+};
+
+// 8-bit antialiased coverage of a shape, one byte per pixel
+struct CoverageMask
+{
+    int width, height;
+    QByteArray data;
+
+    inline const uchar *scanLine(int y) const { return reinterpret_cast<const uchar*>(data.constData()) + y * width; }
+};
+
+// 1-bit mask for hit testing, one bit per pixel, row by row.
+// bounds - the area of the mask, in the coordinates of the piece
+struct HitMask
+{
+    QRect bounds;
+    QBitArray bits;
+
+    inline bool contains(int x, int y) const
+    {
+        return bounds.contains(x, y) && bits.testBit((y - bounds.top()) * bounds.width() + x - bounds.left());
+    }
+};
+
+// Rasterizes the shape into a coverage mask of the given size.
+// ----------
+// The shape (a rectangle with circular tabs and blanks) is evaluated analytically
+// as a signed distance at the center of every pixel, with SSE2 when available,
+// so no QPainterPath boolean operations are needed for painting a piece.
+// offset - translation of the shape in the mask
+// ----------
+CoverageMask rasterizeShape(const ShapeGeometry &geometry, const QSize &size, const QPointF &offset);
+
+// Cuts a part out of a mask, optionally flipped.
+// ----------
+// The source is flipped inside its own bounds first, then the region at
+// offset with the given size is copied. Pixels outside the source are empty.
+// ----------
+CoverageMask transformMask(const CoverageMask &source, MatchMode flip, const QSize &size, const QPoint &offset);
+
+// Returns the smallest rectangle which contains every covered pixel of the mask
+QRect maskBounds(const CoverageMask &mask);
+
+// Creates a hit mask from a rectangle and the pixels of a mask which are at least half covered.
+// maskOffset - where the coverage mask is, in the same coordinates as the rectangle
+HitMask createHitMask(const QRect &rect, const CoverageMask &mask, const QPoint &maskOffset);
+
+// Multiplies premultiplied pixels with the coverage of a mask.
+// dst and src may be the same, count is the number of pixels.
+void multiplyByMask(QRgb *dst, const QRgb *src, const uchar *mask, int count);
+
+}
+}
+
+#endif // MASKRASTERIZER_H
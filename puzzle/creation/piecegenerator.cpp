@@ -0,0 +1,232 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "piecegenerator.h"
+#include "imageprocessor.h"
+#include "../../helpers/util.h"
+
+// How many jobs a worker takes from its own range at once
+#define PIECEGENERATOR_CHUNK_SIZE 4
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+struct WorkRange
+{
+    QMutex mutex;
+    int begin, end;
+};
+
+class PieceGeneratorPrivate
+{
+    friend class PieceGenerator;
+    friend class PieceWorker;
+
+    const ImageProcessor *imageProcessor;
+    QVector<PieceJob> jobs;
+    QVector<PieceResult> results;
+    PieceResult *resultData;
+    WorkRange *ranges;
+    int workerCount, runningWorkers;
+    QAtomicInt finishedJobs, canceled;
+    QMutex doneMutex;
+    QWaitCondition doneCondition;
+    QElapsedTimer timer;
+    qint64 elapsed;
+
+    bool takeWork(int worker, int &begin, int &end);
+    void runJob(int index);
+};
+
+class PieceWorker : public QRunnable
+{
+    PieceGeneratorPrivate *_p;
+    int _worker;
+
+public:
+    PieceWorker(PieceGeneratorPrivate *p, int worker) : _p(p), _worker(worker) { }
+    void run();
+};
+
+bool PieceGeneratorPrivate::takeWork(int worker, int &begin, int &end)
+{
+    if (canceled.fetchAndAddRelaxed(0))
+        return false;
+
+    // Take the next chunk from our own range
+    {
+        WorkRange &own = ranges[worker];
+        QMutexLocker locker(&own.mutex);
+
+        if (own.begin < own.end)
+        {
+            begin = own.begin;
+            end = own.begin = MIN(own.begin + PIECEGENERATOR_CHUNK_SIZE, own.end);
+            return true;
+        }
+    }
+
+    // Our own range is empty, so steal the second half of another worker's range
+    for (int k = 1; k < workerCount; k++)
+    {
+        WorkRange &victim = ranges[(worker + k) % workerCount];
+        QMutexLocker victimLocker(&victim.mutex);
+        int remaining = victim.end - victim.begin;
+
+        if (remaining <= 0)
+            continue;
+
+        begin = victim.end - (remaining + 1) / 2;
+        end = victim.end;
+        victim.end = begin;
+        victimLocker.unlock();
+
+        // Keep the stolen range as our own and process its first chunk
+        WorkRange &own = ranges[worker];
+        QMutexLocker locker(&own.mutex);
+        own.begin = MIN(begin + PIECEGENERATOR_CHUNK_SIZE, end);
+        own.end = end;
+        end = own.begin;
+        return true;
+    }
+
+    // There is no work left at all
+    return false;
+}
+
+void PieceGeneratorPrivate::runJob(int index)
+{
+    const PieceJob &job = jobs.at(index);
+    PieceResult &result = resultData[index];
+
+    // Paint the image, or copy it out of the cache
+    if (job.cachedPiece.isNull())
+        result.piece = imageProcessor->drawPiece(job.i, job.j, job.mask, job.corr);
+    else
+        result.piece = job.cachedPiece.copy();
+}
+
+void PieceWorker::run()
+{
+    int begin, end;
+
+    while (_p->takeWork(_worker, begin, end))
+    {
+        for (int k = begin; k < end; k++)
+            _p->runJob(k);
+
+        _p->finishedJobs.fetchAndAddOrdered(end - begin);
+    }
+
+    QMutexLocker locker(&_p->doneMutex);
+    if (--_p->runningWorkers == 0)
+    {
+        _p->elapsed = _p->timer.elapsed();
+        _p->doneCondition.wakeAll();
+    }
+}
+
+PieceGenerator::PieceGenerator(const ImageProcessor *imageProcessor, const QVector<PieceJob> &jobs)
+{
+    _p = new PieceGeneratorPrivate();
+    _p->imageProcessor = imageProcessor;
+    _p->jobs = jobs;
+    _p->results.resize(jobs.count());
+    _p->resultData = _p->results.data();
+    _p->ranges = 0;
+    _p->workerCount = 0;
+    _p->runningWorkers = 0;
+    _p->elapsed = 0;
+}
+
+PieceGenerator::~PieceGenerator()
+{
+    // The workers use the private object, so they must finish first
+    waitForDone();
+    delete [] _p->ranges;
+    delete _p;
+}
+
+void PieceGenerator::start()
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int count = _p->jobs.count();
+
+    // Give every worker an equal, contiguous part of the jobs
+    _p->workerCount = MAX(1, MIN(pool->maxThreadCount(), count));
+    _p->ranges = new WorkRange[_p->workerCount];
+    _p->runningWorkers = _p->workerCount;
+    _p->timer.start();
+
+    for (int w = 0; w < _p->workerCount; w++)
+    {
+        _p->ranges[w].begin = count * w / _p->workerCount;
+        _p->ranges[w].end = count * (w + 1) / _p->workerCount;
+    }
+
+    for (int w = 0; w < _p->workerCount; w++)
+        pool->start(new PieceWorker(_p, w));
+}
+
+void PieceGenerator::cancel()
+{
+    // The workers stop after finishing the chunk they are working on
+    _p->canceled.fetchAndStoreOrdered(1);
+}
+
+bool PieceGenerator::waitForDone(unsigned long msecs)
+{
+    QMutexLocker locker(&_p->doneMutex);
+
+    while (_p->runningWorkers > 0)
+    {
+        if (!_p->doneCondition.wait(&_p->doneMutex, msecs))
+            return false;
+    }
+
+    return true;
+}
+
+int PieceGenerator::finishedCount() const
+{
+    // NOTE: this works with both the Qt 4 and the Qt 5 QAtomicInt API
+    return _p->finishedJobs.fetchAndAddRelaxed(0);
+}
+
+qint64 PieceGenerator::elapsed() const
+{
+    QMutexLocker locker(&_p->doneMutex);
+    return _p->runningWorkers > 0 ? _p->timer.elapsed() : _p->elapsed;
+}
+
+const QVector<PieceResult> &PieceGenerator::results() const
+{
+    return _p->results;
+}
+
+}
+}
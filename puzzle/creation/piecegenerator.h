@@ -0,0 +1,77 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef PIECEGENERATOR_H
+#define PIECEGENERATOR_H
+
+#include <QImage>
+#include <QVector>
+#include <climits>
+#include "helpertypes.h"
+#include "maskrasterizer.h"
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+// Everything that is needed to paint a single puzzle piece.
+// The mask is shared by the pieces with the same status.
+// If the piece was found in the cache, it is not painted, just copied from the cached image.
+struct PieceJob
+{
+    int i, j, status;
+    Correction corr;
+    CoverageMask mask;
+    QImage cachedPiece;
+};
+
+// The output of a PieceJob
+// NOTE: the strokes and the hit masks are not created here, because they are shared by the pieces
+struct PieceResult
+{
+    QImage piece;
+};
+
+class PieceGeneratorPrivate;
+
+// Paints the puzzle pieces on multiple threads.
+// ----------
+// Every worker of the thread pool owns a contiguous range of the jobs,
+// and when it runs out of work, it steals half of the remaining range
+// of another worker. The results are stored in the same order as the jobs.
+// ----------
+class PieceGenerator
+{
+    PieceGeneratorPrivate *_p;
+
+public:
+    explicit PieceGenerator(const ImageProcessor *imageProcessor, const QVector<PieceJob> &jobs);
+    ~PieceGenerator();
+
+    void start();
+    void cancel();
+    bool waitForDone(unsigned long msecs = ULONG_MAX);
+    int finishedCount() const;
+    qint64 elapsed() const;
+    const QVector<PieceResult> &results() const;
+};
+
+}
+}
+
+#endif // PIECEGENERATOR_H
@@ -0,0 +1,434 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <cstring>
+
+#include <QFile>
+#include <QDir>
+#include <QDataStream>
+#include <QTextStream>
+#include <QStringList>
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QDebug>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+#include "puzzlecache.h"
+#include "shapeprocessor.h"
+#include "../../helpers/util.h"
+
+// Increase this when anything changes in the generated pieces or in the file format
+#define PUZZLECACHE_VERSION 2
+#define PUZZLECACHE_MAGIC 0x43504d50
+// The cache is kept below this size
+#define PUZZLECACHE_MAX_SIZE (64 * 1024 * 1024)
+// This much of the beginning and the end of the image file is hashed
+#define PUZZLECACHE_HASH_SAMPLE (64 * 1024)
+// The pixels of every piece start at an offset which is a multiple of this
+#define PUZZLECACHE_ALIGNMENT 16
+#define PUZZLECACHE_INDEX "index"
+#define PUZZLECACHE_SUFFIX ".puzzle"
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+// The file starts with this header, followed by the tab statuses,
+// then the table of pieces, then the pixels of the pieces.
+struct PuzzleCacheHeader
+{
+    quint32 magic, version;
+    qint32 viewportWidth, viewportHeight, pixmapWidth, pixmapHeight, unitWidth, unitHeight;
+    qint32 rows, cols, tabSize, tabOffset, tabFull, tabTolerance, strokeThickness, usabilityThickness;
+    qint32 pieceCount;
+    quint32 seed;
+};
+
+// The pixels of a piece are premultiplied ARGB, without padding at the end of the lines
+struct PuzzleCachePiece
+{
+    qint32 width, height;
+    qint64 offset;
+};
+
+class CachedPuzzlePrivate
+{
+    friend class CachedPuzzle;
+    friend class PuzzleCache;
+    QFile file;
+    const uchar *data;
+    const PuzzleCachePiece *pieces;
+    const qint32 *statuses;
+    int pieceCount;
+    unsigned seed;
+    GameDescriptor descriptor;
+};
+
+static inline qint64 alignOffset(qint64 offset)
+{
+    return (offset + PUZZLECACHE_ALIGNMENT - 1) / PUZZLECACHE_ALIGNMENT * PUZZLECACHE_ALIGNMENT;
+}
+
+// Protects the files and the index
+static QMutex cacheMutex;
+// When the cache is disabled, there are no keys, so nothing is loaded or stored
+static QAtomicInt cacheDisabled;
+
+static QString cacheDirectory()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QString path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+    QString path = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+
+    path += "/puzzles/";
+    QDir().mkpath(path);
+    return path;
+}
+
+// The index contains the keys and the sizes of the files, the most recently used first
+static void readIndex(const QString &dir, QStringList &keys, QList<qint64> &sizes)
+{
+    QFile file(dir + PUZZLECACHE_INDEX);
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+
+    QTextStream stream(&file);
+    QString key;
+    qint64 size;
+
+    while (!stream.atEnd())
+    {
+        stream >> key >> size;
+
+        if (stream.status() != QTextStream::Ok || key.isEmpty())
+            break;
+
+        keys.append(key);
+        sizes.append(size);
+        stream.skipWhiteSpace();
+    }
+}
+
+static void writeIndex(const QString &dir, const QStringList &keys, const QList<qint64> &sizes)
+{
+    QFile file(dir + PUZZLECACHE_INDEX);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return;
+
+    QTextStream stream(&file);
+
+    for (int i = 0; i < keys.count(); i++)
+        stream << keys[i] << " " << sizes[i] << "\n";
+}
+
+// Marks the file as the most recently used one (or removes it from the index if the size is negative),
+// then removes the least recently used files until the cache fits into its size.
+static void updateIndex(const QString &dir, const QString &key, qint64 size)
+{
+    QStringList keys;
+    QList<qint64> sizes;
+    readIndex(dir, keys, sizes);
+
+    int index = keys.indexOf(key);
+    if (index >= 0)
+    {
+        keys.removeAt(index);
+        sizes.removeAt(index);
+    }
+
+    if (size >= 0)
+    {
+        keys.prepend(key);
+        sizes.prepend(size);
+    }
+
+    qint64 total = 0;
+    foreach (qint64 s, sizes)
+        total += s;
+
+    while (total > PUZZLECACHE_MAX_SIZE && keys.count() > 1)
+    {
+        qDebug() << Q_FUNC_INFO << "evicting" << keys.last();
+        QFile::remove(dir + keys.last() + PUZZLECACHE_SUFFIX);
+        total -= sizes.last();
+        keys.removeLast();
+        sizes.removeLast();
+    }
+
+    writeIndex(dir, keys, sizes);
+}
+
+CachedPuzzle::CachedPuzzle()
+{
+    _p = new CachedPuzzlePrivate();
+    _p->data = 0;
+    _p->pieces = 0;
+    _p->statuses = 0;
+    _p->pieceCount = 0;
+    _p->seed = 0;
+}
+
+CachedPuzzle::~CachedPuzzle()
+{
+    if (_p->data)
+        _p->file.unmap(const_cast<uchar*>(_p->data));
+
+    delete _p;
+}
+
+const GameDescriptor &CachedPuzzle::descriptor() const
+{
+    return _p->descriptor;
+}
+
+unsigned CachedPuzzle::seed() const
+{
+    return _p->seed;
+}
+
+QVector<int> CachedPuzzle::statuses() const
+{
+    QVector<int> result(_p->pieceCount);
+    memcpy(result.data(), _p->statuses, _p->pieceCount * sizeof(qint32));
+    return result;
+}
+
+int CachedPuzzle::pieceCount() const
+{
+    return _p->pieceCount;
+}
+
+QImage CachedPuzzle::piece(int index) const
+{
+    const PuzzleCachePiece &piece = _p->pieces[index];
+    return QImage(_p->data + piece.offset, piece.width, piece.height, piece.width * 4, QImage::Format_ARGB32_Premultiplied);
+}
+
+// NOTE: only the beginning and the end of the image file (and its size) are hashed,
+//       because hashing a whole photo would take longer than what the cache saves.
+QString PuzzleCache::key(const QString &imageUrl, int rows, int cols, const QSize &viewportSize, int strokeThickness)
+{
+    QFile file(imageUrl);
+
+    if (cacheDisabled.fetchAndAddRelaxed(0) || !file.open(QIODevice::ReadOnly))
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    qint64 size = file.size();
+    hash.addData(file.read(PUZZLECACHE_HASH_SAMPLE));
+
+    if (size > PUZZLECACHE_HASH_SAMPLE)
+    {
+        file.seek(MAX(PUZZLECACHE_HASH_SAMPLE, size - PUZZLECACHE_HASH_SAMPLE));
+        hash.addData(file.read(PUZZLECACHE_HASH_SAMPLE));
+    }
+
+    QByteArray params;
+    QDataStream stream(&params, QIODevice::WriteOnly);
+    stream << size << rows << cols << viewportSize << strokeThickness << PUZZLECACHE_VERSION;
+    hash.addData(params);
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+// NOTE: the statuses in the file are checked against its seed, so a damaged file is never used
+CachedPuzzle *PuzzleCache::load(const QString &key, int rows, int cols)
+{
+    if (key.isEmpty())
+        return 0;
+
+    int pieceCount = rows * cols;
+
+    QMutexLocker locker(&cacheMutex);
+    QString dir = cacheDirectory();
+    CachedPuzzle *puzzle = new CachedPuzzle();
+    CachedPuzzlePrivate *p = puzzle->_p;
+
+    p->file.setFileName(dir + key + PUZZLECACHE_SUFFIX);
+
+    if (!p->file.exists() || !p->file.open(QIODevice::ReadOnly))
+    {
+        delete puzzle;
+        return 0;
+    }
+
+    qint64 size = p->file.size();
+    qint64 tableOffset = alignOffset(sizeof(PuzzleCacheHeader) + pieceCount * sizeof(qint32));
+    qint64 dataOffset = tableOffset + pieceCount * sizeof(PuzzleCachePiece);
+    bool valid = size >= dataOffset;
+
+    if (valid)
+        p->data = p->file.map(0, size);
+
+    const PuzzleCacheHeader *header = reinterpret_cast<const PuzzleCacheHeader*>(p->data);
+    valid = p->data
+            && header->magic == PUZZLECACHE_MAGIC
+            && header->version == PUZZLECACHE_VERSION
+            && header->rows == rows
+            && header->cols == cols
+            && header->pieceCount == pieceCount;
+
+    if (valid)
+    {
+        QVector<int> statuses(pieceCount, 0);
+        generatePuzzlePieceStatuses(rows, cols, statuses.data(), header->seed);
+        p->statuses = reinterpret_cast<const qint32*>(p->data + sizeof(PuzzleCacheHeader));
+        valid = !memcmp(p->statuses, statuses.constData(), pieceCount * sizeof(qint32));
+    }
+
+    if (valid)
+    {
+        p->seed = header->seed;
+        p->pieceCount = header->pieceCount;
+        p->pieces = reinterpret_cast<const PuzzleCachePiece*>(p->data + tableOffset);
+
+        for (int i = 0; i < p->pieceCount && valid; i++)
+        {
+            const PuzzleCachePiece &piece = p->pieces[i];
+            valid = piece.width > 0 && piece.height > 0 && piece.offset >= dataOffset
+                    && piece.offset + (qint64) piece.width * piece.height * 4 <= size;
+        }
+    }
+
+    if (!valid)
+    {
+        qDebug() << Q_FUNC_INFO << "removing invalid file" << p->file.fileName();
+        if (p->data)
+            p->file.unmap(const_cast<uchar*>(p->data));
+        p->data = 0;
+        p->file.remove();
+        updateIndex(dir, key, -1);
+        delete puzzle;
+        return 0;
+    }
+
+    GameDescriptor &desc = p->descriptor;
+    desc.viewportSize = QSize(header->viewportWidth, header->viewportHeight);
+    desc.pixmapSize = QSize(header->pixmapWidth, header->pixmapHeight);
+    desc.unitSize = QSize(header->unitWidth, header->unitHeight);
+    desc.rows = header->rows;
+    desc.cols = header->cols;
+    desc.tabSize = header->tabSize;
+    desc.tabOffset = header->tabOffset;
+    desc.tabFull = header->tabFull;
+    desc.tabTolerance = header->tabTolerance;
+    desc.strokeThickness = header->strokeThickness;
+    desc.usabilityThickness = header->usabilityThickness;
+
+    updateIndex(dir, key, size);
+    return puzzle;
+}
+
+void PuzzleCache::store(const QString &key, const GameDescriptor &desc, unsigned seed, const QVector<int> &statuses, const QVector<QImage> &pieces)
+{
+    if (key.isEmpty() || statuses.count() != pieces.count())
+        return;
+
+    QMutexLocker locker(&cacheMutex);
+    QString dir = cacheDirectory();
+
+    PuzzleCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PUZZLECACHE_MAGIC;
+    header.version = PUZZLECACHE_VERSION;
+    header.viewportWidth = desc.viewportSize.width();
+    header.viewportHeight = desc.viewportSize.height();
+    header.pixmapWidth = desc.pixmapSize.width();
+    header.pixmapHeight = desc.pixmapSize.height();
+    header.unitWidth = desc.unitSize.width();
+    header.unitHeight = desc.unitSize.height();
+    header.rows = desc.rows;
+    header.cols = desc.cols;
+    header.tabSize = desc.tabSize;
+    header.tabOffset = desc.tabOffset;
+    header.tabFull = desc.tabFull;
+    header.tabTolerance = desc.tabTolerance;
+    header.strokeThickness = desc.strokeThickness;
+    header.usabilityThickness = desc.usabilityThickness;
+    header.pieceCount = pieces.count();
+    header.seed = seed;
+
+    // Lay out the pixels of the pieces
+    QVector<PuzzleCachePiece> table(pieces.count());
+    qint64 tableOffset = alignOffset(sizeof(PuzzleCacheHeader) + statuses.count() * sizeof(qint32));
+    qint64 offset = tableOffset + pieces.count() * sizeof(PuzzleCachePiece);
+
+    for (int i = 0; i < pieces.count(); i++)
+    {
+        if (pieces[i].format() != QImage::Format_ARGB32_Premultiplied)
+            return;
+
+        offset = alignOffset(offset);
+        table[i].width = pieces[i].width();
+        table[i].height = pieces[i].height();
+        table[i].offset = offset;
+        offset += (qint64) table[i].width * table[i].height * 4;
+    }
+
+    // Write into a temporary file first, so that a half written file is never loaded
+    QString path = dir + key + PUZZLECACHE_SUFFIX;
+    QFile file(path + ".tmp");
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+
+    static const char padding[PUZZLECACHE_ALIGNMENT] = { 0 };
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header)
+            && file.write(reinterpret_cast<const char*>(statuses.constData()), statuses.count() * sizeof(qint32)) == (qint64) (statuses.count() * sizeof(qint32))
+            && file.write(padding, tableOffset - file.pos()) >= 0
+            && file.write(reinterpret_cast<const char*>(table.constData()), table.count() * sizeof(PuzzleCachePiece)) == (qint64) (table.count() * sizeof(PuzzleCachePiece));
+
+    for (int i = 0; i < pieces.count() && ok; i++)
+    {
+        ok = file.write(padding, table[i].offset - file.pos()) >= 0;
+
+        for (int y = 0; y < table[i].height && ok; y++)
+            ok = file.write(reinterpret_cast<const char*>(pieces[i].constScanLine(y)), table[i].width * 4) == table[i].width * 4;
+    }
+
+    file.close();
+
+    if (!ok)
+    {
+        file.remove();
+        return;
+    }
+
+    QFile::remove(path);
+    file.rename(path);
+    updateIndex(dir, key, offset);
+}
+
+void PuzzleCache::setEnabled(bool enabled)
+{
+    cacheDisabled.fetchAndStoreRelaxed(enabled ? 0 : 1);
+}
+
+}
+}
@@ -0,0 +1,72 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef PUZZLECACHE_H
+#define PUZZLECACHE_H
+
+#include <QString>
+#include <QVector>
+#include <QImage>
+#include "helpertypes.h"
+
+namespace Puzzle
+{
+namespace Creation
+{
+
+class CachedPuzzlePrivate;
+
+// A generated puzzle which is loaded from the cache.
+// The pieces are in a memory mapped file, so they are only valid while this object exists.
+class CachedPuzzle
+{
+    friend class PuzzleCache;
+    CachedPuzzlePrivate *_p;
+    CachedPuzzle();
+
+public:
+    ~CachedPuzzle();
+
+    const GameDescriptor &descriptor() const;
+    unsigned seed() const;
+    QVector<int> statuses() const;
+    int pieceCount() const;
+    QImage piece(int index) const;
+};
+
+// Stores the generated puzzles on the disk.
+// ----------
+// Every puzzle is in its own file, named after a key which contains the image, rows, cols,
+// viewport and stroke. There is only one tab layout for each of these: the file also keeps
+// the seed of the tab statuses, and a game which is started again reuses it, so that it can
+// be loaded from the cache. The files are evicted in least recently used order when
+// the cache grows too big. All the functions are thread-safe.
+// When the cache is disabled (eg. for benchmarking), nothing is loaded or stored.
+// ----------
+class PuzzleCache
+{
+public:
+    static QString key(const QString &imageUrl, int rows, int cols, const QSize &viewportSize, int strokeThickness);
+    static CachedPuzzle *load(const QString &key, int rows, int cols);
+    static void store(const QString &key, const GameDescriptor &descriptor, unsigned seed, const QVector<int> &statuses, const QVector<QImage> &pieces);
+    static void setEnabled(bool enabled);
+};
+
+}
+}
+
+#endif // PUZZLECACHE_H
@@ -17,7 +17,6 @@
 // Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
 
 #include <QPainter>
-#include <QMap>
 #include <QPainterPathStroker>
 #include <QDebug>
 
@@ -101,171 +100,396 @@ static QPainterPath createPuzzleShape(QSize unit, int status, qreal tabFull, qre
     return clip;
 }
 
+// Each edge of a piece is either a tab, a blank or a border,
+// so there are 3^4 = 81 possible statuses of a piece.
+#define SHAPE_TABLE_SIZE 81
+
+// Maps the 3 bits of an edge to 0 (tab), 1 (blank) or 2 (border)
+static const int edgeCodes[8] = { -1, 0, 1, -1, 2, -1, -1, -1 };
+
+static inline int shapeTableIndex(int status)
+{
+    return edgeCodes[status & 7]
+            + edgeCodes[(status >> 3) & 7] * 3
+            + edgeCodes[(status >> 6) & 7] * 9
+            + edgeCodes[(status >> 9) & 7] * 27;
+}
+
+static inline int shapeTableIndex(int left, int top, int right, int bottom)
+{
+    return left + top * 3 + right * 9 + bottom * 27;
+}
+
 namespace Puzzle
 {
 namespace Creation
 {
 
+// Describes one of the possible statuses.
+// Every status is equivalent to a "canonical" one: its shape is either generated
+// or it is the horizontally and/or vertically flipped shape of the canonical one.
+// The masks are rasterized only for the canonical status (in the full size of
+// the shape), the other statuses get their own part of that, flipped.
+// The stroke mask is only stored for the canonical status, cut to its bounds,
+// because the strokes are shared by the equivalent statuses.
+struct ShapeTableEntry
+{
+    int status, canonicalIndex;
+    MatchMode matchMode;
+    Correction correction;
+    bool hasShape, hasStrokeShape, hasMask, hasStrokeMask, hasHitMask;
+    QPainterPath shape, strokeShape;
+    CoverageMask mask, strokeMask, fullMask;
+    QRect strokeBounds;
+    HitMask hitMask;
+};
+
 class ShapeProcessorPrivate
 {
     friend class ShapeProcessor;
     QSize unit;
     qreal tabFull, tabSize, tabOffset, tabTolerance;
     int strokeThickness, shapeRequests, shapeCacheHits;
-    QMap<int, QPainterPath> shapeCache, strokeShapeCache;
+    ShapeTableEntry table[SHAPE_TABLE_SIZE];
+
+    void buildTable();
+    Correction calculateCorrection(int status) const;
+    QTransform flipTransform(MatchMode m, qreal width, qreal height) const;
+    ShapeGeometry geometry(int status) const;
+    ShapeGeometry strokeGeometry(int status) const;
+    const CoverageMask &fullMask(int canonicalIndex);
+    const ShapeTableEntry &canonicalStroke(int canonicalIndex);
 };
 
-ShapeProcessor::ShapeProcessor(const GameDescriptor &descriptor)
+void ShapeProcessorPrivate::buildTable()
 {
-    _p = new ShapeProcessorPrivate();
+    for (int index = 0; index < SHAPE_TABLE_SIZE; index++)
+    {
+        ShapeTableEntry &entry = table[index];
+        int left = index % 3, top = index / 3 % 3, right = index / 9 % 3, bottom = index / 27;
 
-    _p->unit = descriptor.unitSize;
-    _p->tabFull = descriptor.tabFull;
-    _p->tabSize = descriptor.tabSize;
-    _p->tabOffset = descriptor.tabOffset;
-    _p->tabTolerance = descriptor.tabTolerance;
-    _p->strokeThickness = descriptor.strokeThickness;
+        entry.status = (1 << left) | ((1 << top) << 3) | ((1 << right) << 6) | ((1 << bottom) << 9);
+        entry.correction = calculateCorrection(entry.status);
+        entry.hasShape = entry.hasStrokeShape = entry.hasMask = entry.hasStrokeMask = entry.hasHitMask = false;
 
-    _p->shapeRequests = 0;
-    _p->shapeCacheHits = 0;
-}
+        // The equivalent status with the smallest index is the canonical one
+        int h = shapeTableIndex(right, top, left, bottom),
+            v = shapeTableIndex(left, bottom, right, top),
+            hv = shapeTableIndex(right, bottom, left, top);
 
-ShapeProcessor::~ShapeProcessor()
-{
-    delete _p;
+        entry.canonicalIndex = index;
+        entry.matchMode = ExactMatch;
+
+        if (h < entry.canonicalIndex)
+        {
+            entry.canonicalIndex = h;
+            entry.matchMode = HorizontalFlipMatch;
+        }
+        if (v < entry.canonicalIndex)
+        {
+            entry.canonicalIndex = v;
+            entry.matchMode = VerticalFlipMatch;
+        }
+        if (hv < entry.canonicalIndex)
+        {
+            entry.canonicalIndex = hv;
+            entry.matchMode = HorizontalAndVerticalFlipMatch;
+        }
+    }
 }
 
-Correction ShapeProcessor::getCorrectionFor(int status)
+Correction ShapeProcessorPrivate::calculateCorrection(int status) const
 {
     Correction result = { 0, 0, 0, 0, 0, 0 };
 
     // Left
     if (status & Puzzle::Creation::LeftBlank)
     {
-        result.xCorrection -= _p->tabFull;
+        result.xCorrection -= tabFull;
     }
     else if (status & Puzzle::Creation::LeftTab)
     {
-        result.sxCorrection -= _p->tabFull;
-        result.widthCorrection += _p->tabFull;
+        result.sxCorrection -= tabFull;
+        result.widthCorrection += tabFull;
     }
     else if (status & Puzzle::Creation::LeftBorder)
     {
-        result.xCorrection -= _p->tabFull;
+        result.xCorrection -= tabFull;
     }
 
     // Top
     if (status & Puzzle::Creation::TopBlank)
     {
-        result.yCorrection -= _p->tabFull;
+        result.yCorrection -= tabFull;
     }
     else if (status & Puzzle::Creation::TopTab)
     {
-        result.syCorrection -= _p->tabFull;
-        result.heightCorrection += _p->tabFull;
+        result.syCorrection -= tabFull;
+        result.heightCorrection += tabFull;
     }
     else if (status & Puzzle::Creation::TopBorder)
     {
-        result.yCorrection -= _p->tabFull;
+        result.yCorrection -= tabFull;
     }
 
     // Right
     if (status & Puzzle::Creation::RightTab)
     {
-        result.widthCorrection += _p->tabFull;
+        result.widthCorrection += tabFull;
     }
 
     // Bottom
     if (status & Puzzle::Creation::BottomTab)
     {
-        result.heightCorrection += _p->tabFull;
+        result.heightCorrection += tabFull;
     }
 
     return result;
 }
 
-QPainterPath ShapeProcessor::getPuzzlePieceShape(int status)
+// Transforms a shape of the given size into the shape of an equivalent status
+QTransform ShapeProcessorPrivate::flipTransform(MatchMode m, qreal width, qreal height) const
 {
-    _p->shapeRequests++;
+    QTransform tr;
 
-    if (!_p->shapeCache.contains(status))
-    {
-        foreach (int s, _p->shapeCache.keys())
-        {
-            MatchMode m = match(s, status);
+    if (m == HorizontalFlipMatch)
+        tr = tr.scale(-1.0, 1.0).translate(-width, 0);
+    else if (m == VerticalFlipMatch)
+        tr = tr.scale(1.0, -1.0).translate(0, -height);
+    else if (m == HorizontalAndVerticalFlipMatch)
+        tr = tr.scale(-1.0, -1.0).translate(-width, -height);
+
+    return tr;
+}
 
-            if (m == NoMatch)
-                continue;
+ShapeProcessor::ShapeProcessor(const GameDescriptor &descriptor)
+{
+    _p = new ShapeProcessorPrivate();
+
+    _p->unit = descriptor.unitSize;
+    _p->tabFull = descriptor.tabFull;
+    _p->tabSize = descriptor.tabSize;
+    _p->tabOffset = descriptor.tabOffset;
+    _p->tabTolerance = descriptor.tabTolerance;
+    _p->strokeThickness = descriptor.strokeThickness;
 
-            // Found a shape which matches, but needs transforming
+    _p->shapeRequests = 0;
+    _p->shapeCacheHits = 0;
 
-            QTransform tr;
+    _p->buildTable();
+}
 
-            if (m == HorizontalFlipMatch)
-                tr = tr.scale(-1.0, 1.0).translate(-_p->unit.width() - _p->tabFull * 2, 0);
-            else if (m == VerticalFlipMatch)
-                tr = tr.scale(1.0, -1.0).translate(0, - _p->unit.height() - _p->tabFull * 2);
-            else if (m == HorizontalAndVerticalFlipMatch)
-                tr = tr.scale(-1.0, -1.0).translate(-_p->unit.width() - _p->tabFull * 2, - _p->unit.height() - _p->tabFull * 2);
+ShapeProcessor::~ShapeProcessor()
+{
+    delete _p;
+}
 
-            _p->shapeCacheHits++;
-            return _p->shapeCache[status] = tr.map(_p->shapeCache[s]);
-        }
+Correction ShapeProcessor::getCorrectionFor(int status)
+{
+    return _p->table[shapeTableIndex(status)].correction;
+}
 
-        // No match in the cache, need to generate a new shape
+QPainterPath ShapeProcessor::getPuzzlePieceShape(int status)
+{
+    _p->shapeRequests++;
+    ShapeTableEntry &entry = _p->table[shapeTableIndex(status)];
 
-        return _p->shapeCache[status] =
-                createPuzzleShape(
+    if (entry.hasShape)
+    {
+        // Found it in the cache
+        _p->shapeCacheHits++;
+        return entry.shape;
+    }
+
+    if (entry.matchMode != ExactMatch)
+    {
+        // Equivalent to another shape, which just needs transforming
+        QPainterPath canonical = getPuzzlePieceShape(_p->table[entry.canonicalIndex].status);
+        _p->shapeRequests--;
+
+        entry.shape = _p->flipTransform(entry.matchMode, _p->unit.width() + _p->tabFull * 2, _p->unit.height() + _p->tabFull * 2).map(canonical);
+    }
+    else
+    {
+        // Need to generate a new shape
+        entry.shape = createPuzzleShape(
                     _p->unit,
                     status, _p->tabFull, _p->tabSize, _p->tabOffset, _p->tabTolerance, _p->tabSize, _p->tabOffset);
     }
 
-    // Found an exact match in the cache
-
-    _p->shapeCacheHits++;
-    return _p->shapeCache[status];
+    entry.hasShape = true;
+    return entry.shape;
 }
 
 QPainterPath ShapeProcessor::getPuzzlePieceStrokeShape(int status)
 {
     _p->shapeRequests++;
+    ShapeTableEntry &entry = _p->table[shapeTableIndex(status)];
 
-    if (!_p->strokeShapeCache.contains(status))
+    if (entry.hasStrokeShape)
     {
-        foreach (int s, _p->strokeShapeCache.keys())
-        {
-            MatchMode m = match(s, status);
+        // Found it in the cache
+        _p->shapeCacheHits++;
+        return entry.strokeShape;
+    }
+
+    if (entry.matchMode != ExactMatch)
+    {
+        // Equivalent to another shape, which just needs transforming
+        QPainterPath canonical = getPuzzlePieceStrokeShape(_p->table[entry.canonicalIndex].status);
+        _p->shapeRequests--;
+
+        entry.strokeShape = _p->flipTransform(entry.matchMode,
+                                              _p->unit.width() + _p->tabFull * 2 + _p->strokeThickness * 2,
+                                              _p->unit.height() + _p->tabFull * 2 + _p->strokeThickness * 2).map(canonical);
+    }
+    else
+    {
+        // Need to generate a new shape
+        entry.strokeShape = createPuzzleShape(
+                    QSize(_p->unit.width() + _p->strokeThickness * 2, _p->unit.height() + _p->strokeThickness * 2),
+                    status, _p->tabFull, _p->tabSize + _p->strokeThickness, _p->tabOffset - _p->strokeThickness, _p->tabTolerance, _p->tabSize - _p->strokeThickness, _p->tabOffset + _p->strokeThickness);
+    }
+
+    entry.hasStrokeShape = true;
+    return entry.strokeShape;
+}
 
-            if (m == NoMatch)
-                continue;
+CoverageMask ShapeProcessor::getPuzzlePieceMask(int status)
+{
+    _p->shapeRequests++;
+    ShapeTableEntry &entry = _p->table[shapeTableIndex(status)];
 
-            // Found a shape which matches, but needs transforming
+    if (entry.hasMask)
+    {
+        // Found it in the cache
+        _p->shapeCacheHits++;
+        return entry.mask;
+    }
 
-            QTransform tr;
+    // Cut out the part which is visible on the piece
+    entry.mask = transformMask(_p->fullMask(entry.canonicalIndex), entry.matchMode,
+                               QSize(_p->unit.width() + entry.correction.widthCorrection + 1, _p->unit.height() + entry.correction.heightCorrection + 1),
+                               QPoint(-entry.correction.xCorrection, -entry.correction.yCorrection));
+    entry.hasMask = true;
+    return entry.mask;
+}
 
-            if (m == HorizontalFlipMatch)
-                tr = tr.scale(-1.0, 1.0).translate(-_p->unit.width() - _p->tabFull * 2 - _p->strokeThickness * 2, 0);
-            else if (m == VerticalFlipMatch)
-                tr = tr.scale(1.0, -1.0).translate(0, - _p->unit.height() - _p->tabFull * 2 - _p->strokeThickness * 2);
-            else if (m == HorizontalAndVerticalFlipMatch)
-                tr = tr.scale(-1.0, -1.0).translate(-_p->unit.width() - _p->tabFull * 2 - _p->strokeThickness * 2, - _p->unit.height() - _p->tabFull * 2 - _p->strokeThickness * 2);
+CoverageMask ShapeProcessor::getPuzzlePieceStrokeMask(int status)
+{
+    _p->shapeRequests++;
+    ShapeTableEntry &entry = _p->table[shapeTableIndex(status)];
 
-            _p->shapeCacheHits++;
-            return _p->strokeShapeCache[status] = tr.map(_p->strokeShapeCache[s]);
-        }
+    if (_p->table[entry.canonicalIndex].hasStrokeMask)
+        _p->shapeCacheHits++;
 
-        // No match in the cache, need to generate a new shape
+    return _p->canonicalStroke(entry.canonicalIndex).strokeMask;
+}
 
-        return _p->strokeShapeCache[status] =
-                createPuzzleShape(
-                    QSize(_p->unit.width() + _p->strokeThickness * 2, _p->unit.height() + _p->strokeThickness * 2),
-                    status, _p->tabFull, _p->tabSize + _p->strokeThickness, _p->tabOffset - _p->strokeThickness, _p->tabTolerance, _p->tabSize - _p->strokeThickness, _p->tabOffset + _p->strokeThickness);
+StrokeInfo ShapeProcessor::getStrokeInfo(int status)
+{
+    const ShapeTableEntry &entry = _p->table[shapeTableIndex(status)];
+    const ShapeTableEntry &canonical = _p->canonicalStroke(entry.canonicalIndex);
+    QRect bounds = canonical.strokeBounds;
+
+    // Flip the bounds inside the full size of the stroke shape
+    if (entry.matchMode == HorizontalFlipMatch || entry.matchMode == HorizontalAndVerticalFlipMatch)
+        bounds.moveLeft(_p->unit.width() + _p->tabFull * 2 + _p->strokeThickness * 2 - bounds.right() - 1);
+    if (entry.matchMode == VerticalFlipMatch || entry.matchMode == HorizontalAndVerticalFlipMatch)
+        bounds.moveTop(_p->unit.height() + _p->tabFull * 2 + _p->strokeThickness * 2 - bounds.bottom() - 1);
+
+    StrokeInfo info;
+    info.canonicalStatus = canonical.status;
+    info.flip = entry.matchMode;
+    info.offset = QPoint(bounds.left() + entry.correction.xCorrection - _p->strokeThickness,
+                         bounds.top() + entry.correction.yCorrection - _p->strokeThickness);
+    return info;
+}
+
+// The area where the piece can be grabbed: its stroke shape and a rectangle which is a bit bigger than the unit
+HitMask ShapeProcessor::getPuzzlePieceHitMask(int status)
+{
+    _p->shapeRequests++;
+    ShapeTableEntry &entry = _p->table[shapeTableIndex(status)];
+
+    if (entry.hasHitMask)
+    {
+        // Found it in the cache
+        _p->shapeCacheHits++;
+        return entry.hitMask;
     }
 
-    // Found an exact match in the cache
+    const ShapeTableEntry &canonical = _p->canonicalStroke(entry.canonicalIndex);
+    StrokeInfo info = getStrokeInfo(status);
+    CoverageMask stroke = transformMask(canonical.strokeMask, entry.matchMode, canonical.strokeBounds.size(), QPoint(0, 0));
+    QRect rect(entry.correction.xCorrection + (int) _p->tabFull - 10, entry.correction.yCorrection + (int) _p->tabFull - 10,
+               _p->unit.width() + 20, _p->unit.height() + 20);
+
+    // NOTE: the stroke shape is not moved by the stroke thickness, unlike the stroke image
+    entry.hitMask = createHitMask(rect, stroke, info.offset + QPoint(_p->strokeThickness, _p->strokeThickness));
+    entry.hasHitMask = true;
+    return entry.hitMask;
+}
+
+// NOTE: the geometries are the same parameters which are passed to createPuzzleShape
+
+ShapeGeometry ShapeProcessorPrivate::geometry(int status) const
+{
+    ShapeGeometry g;
+    g.unit = unit;
+    g.status = status;
+    g.tabFull = tabFull;
+    g.tabSize = tabSize;
+    g.tabOffset = tabOffset;
+    g.tabTolerance = tabTolerance;
+    g.blankSize = tabSize;
+    g.blankOffset = tabOffset;
+    return g;
+}
+
+ShapeGeometry ShapeProcessorPrivate::strokeGeometry(int status) const
+{
+    ShapeGeometry g;
+    g.unit = QSize(unit.width() + strokeThickness * 2, unit.height() + strokeThickness * 2);
+    g.status = status;
+    g.tabFull = tabFull;
+    g.tabSize = tabSize + strokeThickness;
+    g.tabOffset = tabOffset - strokeThickness;
+    g.tabTolerance = tabTolerance;
+    g.blankSize = tabSize - strokeThickness;
+    g.blankOffset = tabOffset + strokeThickness;
+    return g;
+}
+
+const CoverageMask &ShapeProcessorPrivate::fullMask(int canonicalIndex)
+{
+    ShapeTableEntry &entry = table[canonicalIndex];
+
+    if (entry.fullMask.data.isEmpty())
+        entry.fullMask = rasterizeShape(geometry(entry.status),
+                                        QSize(unit.width() + tabFull * 2, unit.height() + tabFull * 2),
+                                        QPointF(0, 0));
+
+    return entry.fullMask;
+}
+
+const ShapeTableEntry &ShapeProcessorPrivate::canonicalStroke(int canonicalIndex)
+{
+    ShapeTableEntry &entry = table[canonicalIndex];
+
+    if (!entry.hasStrokeMask)
+    {
+        CoverageMask full = rasterizeShape(strokeGeometry(entry.status),
+                                           QSize(unit.width() + tabFull * 2 + strokeThickness * 2, unit.height() + tabFull * 2 + strokeThickness * 2),
+                                           QPointF(0, 0));
+
+        // Only keep the part which is actually covered
+        entry.strokeBounds = maskBounds(full);
+        entry.strokeMask = transformMask(full, ExactMatch, entry.strokeBounds.size(), entry.strokeBounds.topLeft());
+        entry.hasStrokeMask = true;
+    }
 
-    _p->shapeCacheHits++;
-    return _p->strokeShapeCache[status];
+    return entry;
 }
 
 MatchMode ShapeProcessor::match(int status1, int status2)
@@ -305,8 +529,25 @@ void ShapeProcessor::printPerfCounters() const
               << "(" << (((qreal)_p->shapeCacheHits / (qreal)_p->shapeRequests) * 100) << "%)";
 }
 
-void generatePuzzlePieceStatuses(unsigned rows, unsigned cols, int *statuses)
+QRectF getUsabilityRect(const GameDescriptor &descriptor, const Correction &correction)
+{
+    return QRectF(correction.xCorrection + descriptor.tabFull - 1 - descriptor.usabilityThickness,
+                  correction.yCorrection + descriptor.tabFull - 1 - descriptor.usabilityThickness,
+                  descriptor.unitSize.width() + 1 + descriptor.usabilityThickness * 2,
+                  descriptor.unitSize.height() + 1 + descriptor.usabilityThickness * 2);
+}
+
+// A tiny linear congruential generator, so that the same seed always gives the same statuses
+static inline bool nextRandomBit(unsigned &state)
 {
+    state = state * 1103515245u + 12345u;
+    return (state >> 16) & 1;
+}
+
+void generatePuzzlePieceStatuses(unsigned rows, unsigned cols, int *statuses, unsigned seed)
+{
+    unsigned state = seed;
+
     for (unsigned i = 0; i < cols; i++)
     {
         for (unsigned j = 0; j < rows; j++)
@@ -329,13 +570,13 @@ void generatePuzzlePieceStatuses(unsigned rows, unsigned cols, int *statuses)
 
             // Right
             if (i < cols - 1)
-                statuses[i * rows + j] |= randomInt(0, 1) ? Puzzle::Creation::RightTab : Puzzle::Creation::RightBlank;
+                statuses[i * rows + j] |= nextRandomBit(state) ? Puzzle::Creation::RightTab : Puzzle::Creation::RightBlank;
             else
                 statuses[i * rows + j] |= Puzzle::Creation::RightBorder;
 
             // Bottom
             if (j < rows - 1)
-                statuses[i * rows + j] |= randomInt(0, 1) ? Puzzle::Creation::BottomTab : Puzzle::Creation::BottomBlank;
+                statuses[i * rows + j] |= nextRandomBit(state) ? Puzzle::Creation::BottomTab : Puzzle::Creation::BottomBlank;
             else
                 statuses[i * rows + j] |= Puzzle::Creation::BottomBorder;
         }
@@ -24,6 +24,7 @@
 #include <QPainterPath>
 #include <QList>
 #include "helpertypes.h"
+#include "maskrasterizer.h"
 
 namespace Puzzle
 {
@@ -32,6 +33,15 @@ namespace Creation
 
 class ShapeProcessorPrivate;
 
+// The stroke of a piece is the stroke of its canonical status, flipped.
+// offset - where the flipped stroke is, relative to the top left corner of the piece
+struct StrokeInfo
+{
+    int canonicalStatus;
+    MatchMode flip;
+    QPoint offset;
+};
+
 class ShapeProcessor {
     ShapeProcessorPrivate *_p;
 
@@ -42,12 +52,19 @@ public:
     Correction getCorrectionFor(int status);
     QPainterPath getPuzzlePieceShape(int status);
     QPainterPath getPuzzlePieceStrokeShape(int status);
+    CoverageMask getPuzzlePieceMask(int status);
+    // NOTE: this is the stroke of the canonical status, use getStrokeInfo to place it
+    CoverageMask getPuzzlePieceStrokeMask(int status);
+    StrokeInfo getStrokeInfo(int status);
+    HitMask getPuzzlePieceHitMask(int status);
     MatchMode match(int status1, int status2);
     void printPerfCounters() const;
     void resetPerfCounters();
 };
 
-void generatePuzzlePieceStatuses(unsigned rows, unsigned cols, int *statuses);
+void generatePuzzlePieceStatuses(unsigned rows, unsigned cols, int *statuses, unsigned seed);
+// The rectangle of a piece which can be grabbed, relative to the top left corner of its pixmap
+QRectF getUsabilityRect(const GameDescriptor &descriptor, const Correction &correction);
 
 }
 }
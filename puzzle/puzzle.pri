@@ -0,0 +1,55 @@
+# This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+# The game logic and the puzzle creation, without any UI.
+# This is shared by the app and the benchmarks.
+
+QT += gui
+
+SOURCES += \
+    $$PWD/creation/shapeprocessor.cpp \
+    $$PWD/creation/imageprocessor.cpp \
+    $$PWD/creation/piecegenerator.cpp \
+    $$PWD/creation/maskrasterizer.cpp \
+    $$PWD/creation/imageresampler.cpp \
+    $$PWD/creation/puzzlecache.cpp \
+    $$PWD/creation/groupflattener.cpp \
+    $$PWD/puzzlepieceprimitive.cpp \
+    $$PWD/puzzlepiece.cpp \
+    $$PWD/puzzlegame.cpp \
+    $$PWD/puzzlespatialindex.cpp \
+    $$PWD/puzzlepiecestore.cpp \
+    $$PWD/puzzleanimation.cpp \
+    $$PWD/puzzlegameloader.cpp
+
+HEADERS += \
+    $$PWD/../helpers/util.h \
+    $$PWD/creation/shapeprocessor.h \
+    $$PWD/creation/imageprocessor.h \
+    $$PWD/creation/piecegenerator.h \
+    $$PWD/creation/maskrasterizer.h \
+    $$PWD/creation/imageresampler.h \
+    $$PWD/creation/puzzlecache.h \
+    $$PWD/creation/groupflattener.h \
+    $$PWD/creation/helpertypes.h \
+    $$PWD/puzzlepieceprimitive.h \
+    $$PWD/puzzlepiece.h \
+    $$PWD/puzzlegame.h \
+    $$PWD/puzzlespatialindex.h \
+    $$PWD/puzzlepiecestore.h \
+    $$PWD/puzzleanimation.h \
+    $$PWD/puzzlegameloader.h
@@ -0,0 +1,141 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include "puzzleanimation.h"
+#include "puzzlegame.h"
+#include "puzzlepiece.h"
+
+// How many samples of the easing curve are stored, the values between them are interpolated
+#define PUZZLEANIMATION_EASING_SAMPLES 1024
+
+PuzzleAnimation::PuzzleAnimation(PuzzleGame *game, const QEasingCurve &easingCurve)
+    : QAbstractAnimation(game)
+    , _game(game)
+    , _duration(0)
+    , _lastTime(-1)
+{
+    _easing.resize(PUZZLEANIMATION_EASING_SAMPLES + 1);
+    for (int i = 0; i <= PUZZLEANIMATION_EASING_SAMPLES; i++)
+        _easing[i] = easingCurve.valueForProgress((qreal) i / PUZZLEANIMATION_EASING_SAMPLES);
+}
+
+void PuzzleAnimation::reserve(int count)
+{
+    _pieces.reserve(count);
+    _ids.reserve(count);
+    _delays.reserve(count);
+    _durations.reserve(count);
+    _startX.reserve(count);
+    _startY.reserve(count);
+    _startRotation.reserve(count);
+    _midX.reserve(count);
+    _midY.reserve(count);
+    _midRotation.reserve(count);
+    _endX.reserve(count);
+    _endY.reserve(count);
+    _endRotation.reserve(count);
+}
+
+// Animates the piece straight to the end keyframe
+void PuzzleAnimation::addPiece(PuzzlePiece *piece, const QPointF &endPos, qreal endRotation, int duration, int delay)
+{
+    addPiece(piece, (piece->pos() + endPos) / 2, (piece->rotation() + endRotation) / 2, endPos, endRotation, duration, delay);
+}
+
+// Animates the piece from its current position and rotation through the middle keyframe to the end keyframe
+void PuzzleAnimation::addPiece(PuzzlePiece *piece, const QPointF &midPos, qreal midRotation, const QPointF &endPos, qreal endRotation, int duration, int delay)
+{
+    _pieces.append(piece);
+    _ids.append(piece->index());
+    _delays.append(delay);
+    _durations.append(duration);
+    _startX.append(piece->pos().x());
+    _startY.append(piece->pos().y());
+    _startRotation.append(piece->rotation());
+    _midX.append(midPos.x());
+    _midY.append(midPos.y());
+    _midRotation.append(midRotation);
+    _endX.append(endPos.x());
+    _endY.append(endPos.y());
+    _endRotation.append(endRotation);
+    _duration = MAX(_duration, delay + duration);
+}
+
+// Forgets the pieces, eg. when they are deleted, but the animation still runs until its end
+void PuzzleAnimation::clear()
+{
+    _pieces.clear();
+    _ids.clear();
+    _delays.clear();
+    _durations.clear();
+    _startX.clear();
+    _startY.clear();
+    _startRotation.clear();
+    _midX.clear();
+    _midY.clear();
+    _midRotation.clear();
+    _endX.clear();
+    _endY.clear();
+    _endRotation.clear();
+}
+
+void PuzzleAnimation::updateCurrentTime(int currentTime)
+{
+    PuzzlePieceStore &store = _game->pieceStore();
+    qreal *x = store.x.data(), *y = store.y.data(), *rotation = store.rotation.data();
+    const quint8 *flags = store.flags.constData();
+    const qreal *easing = _easing.constData();
+    int n = _ids.count();
+
+    for (int i = 0; i < n; i++)
+    {
+        int id = _ids[i], elapsed = currentTime - _delays[i];
+
+        // Skip the pieces which are still waiting, which were already at their end
+        // at the previous tick, or which were merged into another piece
+        if (elapsed < 0 || _lastTime - _delays[i] >= _durations[i] || !(flags[id] & PuzzlePieceStore::Alive))
+            continue;
+
+        // Look up the eased progress in the table
+        qreal t = _durations[i] > 0 ? MIN((qreal) elapsed / _durations[i], (qreal) 1) : 1;
+        qreal f = t * PUZZLEANIMATION_EASING_SAMPLES;
+        int k = MIN((int) f, PUZZLEANIMATION_EASING_SAMPLES - 1);
+        qreal p = easing[k] + (easing[k + 1] - easing[k]) * (f - k);
+
+        // Interpolate between the two keyframes which the progress is between,
+        // the elastic curves may overshoot, then the keyframes are extrapolated
+        if (p < 0.5)
+        {
+            qreal s = p * 2;
+            x[id] = _startX[i] + (_midX[i] - _startX[i]) * s;
+            y[id] = _startY[i] + (_midY[i] - _startY[i]) * s;
+            rotation[id] = _startRotation[i] + (_midRotation[i] - _startRotation[i]) * s;
+        }
+        else
+        {
+            qreal s = p * 2 - 1;
+            x[id] = _midX[i] + (_endX[i] - _midX[i]) * s;
+            y[id] = _midY[i] + (_endY[i] - _midY[i]) * s;
+            rotation[id] = _midRotation[i] + (_endRotation[i] - _midRotation[i]) * s;
+        }
+
+        _pieces[i]->markMoved();
+    }
+
+    _lastTime = currentTime;
+}
@@ -0,0 +1,66 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef PUZZLEANIMATION_H
+#define PUZZLEANIMATION_H
+
+#include <QAbstractAnimation>
+#include <QEasingCurve>
+#include <QVector>
+#include <QPointF>
+
+class PuzzleGame;
+class PuzzlePiece;
+
+// Moves and rotates many pieces at once, eg. when the puzzle is shuffled or assembled.
+// ----------
+// Every piece goes from where it was when it was added, through a middle keyframe,
+// to its end keyframe, after waiting for its own delay. The keyframes are kept in
+// flat arrays and the easing curve is sampled into a table when the animation is
+// created, so every tick is one tight loop which writes the piece store directly,
+// instead of two QPropertyAnimations per piece going through the property system.
+// The easing curve is applied to the whole path of a piece, the same way as
+// QVariantAnimation does it with key values.
+// ----------
+class PuzzleAnimation : public QAbstractAnimation
+{
+    Q_OBJECT
+
+    PuzzleGame *_game;
+    QVector<qreal> _easing;
+    QVector<PuzzlePiece*> _pieces;
+    QVector<int> _ids, _delays, _durations;
+    QVector<qreal> _startX, _startY, _startRotation;
+    QVector<qreal> _midX, _midY, _midRotation;
+    QVector<qreal> _endX, _endY, _endRotation;
+    int _duration, _lastTime;
+
+public:
+    explicit PuzzleAnimation(PuzzleGame *game, const QEasingCurve &easingCurve);
+    void reserve(int count);
+    void addPiece(PuzzlePiece *piece, const QPointF &endPos, qreal endRotation, int duration, int delay = 0);
+    void addPiece(PuzzlePiece *piece, const QPointF &midPos, qreal midRotation, const QPointF &endPos, qreal endRotation, int duration, int delay = 0);
+    void clear();
+    int duration() const { return _duration; }
+
+protected:
+    void updateCurrentTime(int currentTime);
+
+};
+
+#endif // PUZZLEANIMATION_H
@@ -18,18 +18,26 @@
 
 #include <QTouchEvent>
 #include <QDebug>
-#include <QCoreApplication>
-#include <QElapsedTimer>
 #include <QTimer>
-#include <QParallelAnimationGroup>
-#include <QSequentialAnimationGroup>
+#include <QEasingCurve>
 #include <QPropertyAnimation>
+#include <qmath.h>
 
 #include "puzzlegame.h"
 #include "puzzlepiece.h"
 #include "puzzlepieceprimitive.h"
-#include "creation/imageprocessor.h"
-#include "creation/shapeprocessor.h"
+#include "puzzlegameloader.h"
+#include "puzzleanimation.h"
+#include "creation/groupflattener.h"
+
+// The size of a cell of the spatial index, relative to the size of a piece
+#define PUZZLEGAME_INDEX_CELL_SIZE 2
+// How often the merged groups are checked for flattening (in msecs)
+#define PUZZLEGAME_FLATTEN_INTERVAL 250
+// How many pieces can be under a point without allocating memory for the hit test
+#define PUZZLEGAME_RESERVED_HIT_CANDIDATES 64
+// How many touch points can be handled without allocating memory
+#define PUZZLEGAME_RESERVED_TOUCH_POINTS 32
 
 static QPointF defaultRotationGuideCoordinates(-1000, -1000);
 
@@ -41,7 +49,7 @@ static QPointF getBottomRight(const PuzzlePiece *piece, const PuzzleGame *game)
     return p;
 }
 
-static PuzzlePiece *findPuzzleItem(QPointF p, const QList<PuzzlePiece*> &puzzleItems)
+PuzzlePiece *PuzzleGame::findPuzzleItem(QPointF p, const QVector<PuzzlePiece*> &puzzleItems)
 {
     foreach (PuzzlePiece *item, puzzleItems)
     {
@@ -52,9 +60,9 @@ static PuzzlePiece *findPuzzleItem(QPointF p, const QList<PuzzlePiece*> &puzzleI
         {
             QPointF pt = tr - pr->pixmapOffset();
 
-            if (!enableUsabilityImprovement && pr->realShape().contains(pt))
+            if (!enableUsabilityImprovement && pr->hitMask().contains(qFloor(pt.x()), qFloor(pt.y())))
                 return item;
-            else if (enableUsabilityImprovement && pr->fakeShape().contains(pt))
+            else if (enableUsabilityImprovement && pr->usabilityRectsContain(pt))
                 return item;
         }
     }
@@ -67,280 +75,221 @@ PuzzleGame::PuzzleGame(QObject *parent)
     , _allowRotation(true)
     , _tolerance(5)
     , _rotationTolerance(10)
+    , _loader(0)
+    , _boardCols(0)
+    , _boardRows(0)
+    , _bottomPiece(0)
+    , _topPiece(0)
+    , _topZValue(0)
+    , _flattener(0)
     , _rotatingWithGuide(false)
 {
+    _flattenTimer = new QTimer(this);
+    _flattenTimer->setInterval(PUZZLEGAME_FLATTEN_INTERVAL);
+    connect(_flattenTimer, SIGNAL(timeout()), this, SLOT(onFlattenTimer()));
+
+    // NOTE: a reserved vector keeps its memory when it's resized, so the hit tests don't allocate
+    _hitCandidates.reserve(PUZZLEGAME_RESERVED_HIT_CANDIDATES);
+    _touchOwners.reserve(PUZZLEGAME_RESERVED_TOUCH_POINTS);
+    _touchedPieces.reserve(PUZZLEGAME_RESERVED_TOUCH_POINTS);
+
     _mouseSubject = 0;
     _strokeThickness = 3;
     _enabled = false;
     setRotationGuideCoordinates(defaultRotationGuideCoordinates);
 }
 
+PuzzleGame::~PuzzleGame()
+{
+    delete _flattener;
+}
+
+// Clears the piece indexes and prepares them for a board of the given size
+// NOTE: the piece ids start over, so this must only be called when there are no pieces
+void PuzzleGame::setBoardSize(int cols, int rows)
+{
+    _boardCols = cols;
+    _boardRows = rows;
+    _pieces.clear();
+    _pieces.reserve(cols * rows);
+    _pieceStore.clear();
+    _pieceGrid.fill(-1, cols * rows);
+
+    // A cell is about twice as big as a piece, so a piece is in at most 4 cells
+    qreal cellSize = 0;
+    if (cols > 0 && rows > 0)
+        cellSize = myMax<qreal>((qreal) width() / cols, (qreal) height() / rows) * PUZZLEGAME_INDEX_CELL_SIZE;
+    _spatialIndex.reset(QSizeF(width(), height()), cellSize);
+}
+
+// Hit tests only the pieces which are near the point
+PuzzlePiece *PuzzleGame::findPuzzleItem(const QPointF &p)
+{
+    _spatialIndex.candidatesAt(p, _hitCandidates);
+    return findPuzzleItem(p, _hitCandidates);
+}
+
+// NOTE: this goes through the grid of the pieces instead of the set, which is contiguous memory
 void PuzzleGame::setNeighbours(int x, int y)
 {
-    foreach (PuzzlePiece *p, _puzzleItems)
+    for (int i = 0; i < x; i++)
     {
-        if (p->puzzleCoordinates().x() != x - 1)
-            p->addNeighbour(find(p->puzzleCoordinates() + QPoint(1, 0)));
+        for (int j = 0; j < y; j++)
+        {
+            PuzzlePiece *p = find(QPoint(i, j));
+            if (!p)
+                continue;
+
+            if (i != x - 1)
+                p->addNeighbour(find(QPoint(i + 1, j)));
 
-        if (p->puzzleCoordinates().y() != y - 1)
-            p->addNeighbour(find(p->puzzleCoordinates() + QPoint(0, 1)));
+            if (j != y - 1)
+                p->addNeighbour(find(QPoint(i, j + 1)));
+        }
     }
 }
 
 PuzzlePiece *PuzzleGame::find(const QPoint &puzzleCoordinates)
 {
-    foreach (PuzzlePiece *p, _puzzleItems)
-    {
-        if (p->puzzleCoordinates() == puzzleCoordinates)
-            return p;
-    }
-    return 0;
+    int x = puzzleCoordinates.x(), y = puzzleCoordinates.y();
+
+    if (x < 0 || y < 0 || x >= _boardCols || y >= _boardRows)
+        return 0;
+
+    // If the piece was merged, return the piece of its group
+    int index = _pieceGrid[x * _boardRows + y];
+    return index < 0 ? 0 : _pieces[_pieceStore.findGroup(index)];
 }
 
-bool PuzzleGame::startGame(const QString &imageUrl, int rows, int cols, bool allowRotation)
+PuzzleGameLoader *PuzzleGame::startGame(const QString &imageUrl, int rows, int cols, bool allowRotation)
 {
-    emit loadProgressChanged(0);
+    // NOTE: this also cancels the previous loading, if it's still in progress
     deleteAllPieces();
     disable();
     setRotationGuideCoordinates(defaultRotationGuideCoordinates);
+    emit loadProgressChanged(0);
 
-    QCoreApplication::instance()->processEvents();
-
-    if (height() == 0 || height() == 0)
+    if (width() == 0 || height() == 0)
     {
         qDebug() << "The size of this PuzzleBoardItem item is not okay, not starting game.";
-        return false;
-    }
-
-    QElapsedTimer timer;
-    timer.start();
-
-    qDebug() << "trying to start game with" << imageUrl;
-    Puzzle::Creation::ImageProcessor imageProcessor(imageUrl, QSize(width(), height()), rows, cols, _strokeThickness);
-
-    if (!imageProcessor.isValid())
-    {
-        qDebug() << "pixmap is null, not starting game.";
-        return false;
+        return 0;
     }
 
-    qDebug() << timer.elapsed() << "ms spent with processing the image";
-    timer.restart();
-
-    const Puzzle::Creation::GameDescriptor &desc = imageProcessor.descriptor();
-    int *statuses = new int[cols * rows], tShape = 0, tPaint = 0;
-    qreal   w0 = (width() - desc.cols * desc.unitSize.width()) / 2,
-            h0 = (height() - desc.rows * desc.unitSize.height()) / 2;
-
     _allowRotation = allowRotation;
-    _tabSize = desc.tabSize;
-    _tabOffset = desc.tabOffset;
-    _unit = desc.unitSize;
-
-    memset(statuses, 0, rows * cols * sizeof(int));
-
-    static int previousRows = rows, previousCols = cols, previousPixmapW = desc.pixmapSize.width(), previousPixmapH = desc.pixmapSize.height();
-    static Puzzle::Creation::ShapeProcessor *shapeProcessor = new Puzzle::Creation::ShapeProcessor(desc);
-
-    if (previousRows != rows || previousCols != cols || previousPixmapW != desc.pixmapSize.width() || previousPixmapH != desc.pixmapSize.height())
-    {
-        delete shapeProcessor;
-        shapeProcessor = new Puzzle::Creation::ShapeProcessor(desc);
-    }
-
-    previousRows = rows, previousCols = cols, previousPixmapW = desc.pixmapSize.width(), previousPixmapH = desc.pixmapSize.height();
-    shapeProcessor->resetPerfCounters();
-    Puzzle::Creation::generatePuzzlePieceStatuses(rows, cols, statuses);
-
-    emit this->newGameStarting();
-    QCoreApplication::instance()->processEvents();
-
-    int totalCount = rows * cols, i = cols - 1, j = rows - 1;
-
-    for (int x = 0; x < totalCount; x++)
-    {
-        i = cols - 1 - i;
-        j = rows - 1 - j;
-
-        if (x % 2 == 0 && x != 0)
-        {
-            if (j == rows - 1)
-            {
-                j = 0;
-                i++;
-            }
-            else
-            {
-                j++;
-            }
-        }
-
-        timer.restart();
-
-        QElapsedTimer t;
-        t.start();
-
-        // Creating the shape of the piece
-
-        Puzzle::Creation::Correction corr = shapeProcessor->getCorrectionFor(statuses[i * rows + j]);
-        int &sxCorrection = corr.sxCorrection, &syCorrection = corr.syCorrection, &xCorrection = corr.xCorrection, &yCorrection = corr.yCorrection;
-
-        // Create shapes
-
-        QPainterPath clip = shapeProcessor->getPuzzlePieceShape(statuses[i * rows + j])
-                .translated(xCorrection, yCorrection);;
-        QPainterPath strokePath = shapeProcessor->getPuzzlePieceStrokeShape(statuses[i * rows + j])
-                .translated(xCorrection, yCorrection);
+    _loader = new PuzzleGameLoader(this, imageUrl, rows, cols);
 
-        QPainterPath realShape;
-        realShape.addRect(xCorrection + desc.tabFull - 10, yCorrection + desc.tabFull - 10, desc.unitSize.width() + 20, desc.unitSize.height() + 20);
-        realShape += strokePath;
+    connect(_loader, SIGNAL(progressChanged()), this, SLOT(onLoaderProgressChanged()));
+    connect(_loader, SIGNAL(imageProcessed()), this, SLOT(onLoaderImageProcessed()));
+    connect(_loader, SIGNAL(canceledChanged()), this, SLOT(onLoaderCanceled()));
+    connect(_loader, SIGNAL(finished(bool)), this, SLOT(onLoaderFinished(bool)));
 
-        QPainterPath fakeShape;
-        fakeShape.addRect(desc.tabFull - 1, desc.tabFull - 1, desc.unitSize.width() + 1 + desc.usabilityThickness * 2, desc.unitSize.height() + 1 + desc.usabilityThickness * 2);
-        fakeShape.translate(xCorrection - desc.usabilityThickness, yCorrection - desc.usabilityThickness);
-
-        tShape += t.elapsed();
-        t.restart();
-
-        // Paint pixmaps
-
-        QPixmap px = imageProcessor.drawPiece(i, j, clip, corr);
-        QPixmap stroke = imageProcessor.drawStroke(strokePath, px.size());
-
-        tPaint += t.elapsed();
-        t.restart();
+    _loader->start();
+    emit loaderChanged();
+    return _loader;
+}
 
-        QPointF supposed(w0 + (i * desc.unitSize.width()) + sxCorrection,
-                         h0 + (j * desc.unitSize.height()) + syCorrection);
+void PuzzleGame::cancelLoading()
+{
+    if (!_loader)
+        return;
 
-        // Create the puzzle piece primitive
-        PuzzlePiecePrimitive *primitive = new PuzzlePiecePrimitive();
-        primitive->setPixmap(px);
-        primitive->setStroke(stroke);
-        primitive->setPixmapOffset(QPoint(0, 0));
-        primitive->setStrokeOffset(primitive->pixmapOffset() - QPoint(_strokeThickness, _strokeThickness));
-        primitive->setFakeShape(fakeShape);
-        primitive->setRealShape(realShape);
+    // NOTE: canceling the loader deletes the pieces, which calls this again,
+    //       so the loader is forgotten before that
+    PuzzleGameLoader *loader = _loader;
+    _loader = 0;
+    loader->cancel();
+    loader->deleteLater();
+    emit loaderChanged();
+}
 
-        // Creating the piece item
-        PuzzlePiece *item = new PuzzlePiece(this);
-        item->addPrimitive(primitive, QPointF(0, 0));
-        item->setPuzzleCoordinates(QPoint(i, j));
-        item->setSupposedPosition(supposed);
-        item->setPos(supposed);
-        item->setTabStatus(statuses[i * rows + j]);
-        item->setZValue(i * rows + j + 1);
+void PuzzleGame::onLoaderProgressChanged()
+{
+    emit loadProgressChanged(_loader->progress());
+}
 
-        item->setTransformOriginPoint(QPointF(randomInt(0, desc.unitSize.width()), randomInt(0, desc.unitSize.height())));
+void PuzzleGame::onLoaderImageProcessed()
+{
+    emit newGameStarting();
+}
 
-        connect(item, SIGNAL(noNeighbours()), this, SLOT(assemble()));
-        _puzzleItems.insert(item);
+void PuzzleGame::onLoaderCanceled()
+{
+    // Delete the pieces which were already created
+    deleteAllPieces();
+}
 
-        //qDebug() << timer.elapsed() << "ms spent with generating piece" << i * rows + j + 1 << item->puzzleCoordinates();
-        emit loadProgressChanged(i * rows + j + 1);
-        QCoreApplication::instance()->processEvents();
+void PuzzleGame::onLoaderFinished(bool success)
+{
+    if (!success)
+    {
+        emit loadFailed();
+        return;
     }
 
-    qDebug() << "time spent" << "creating shapes:" << tShape << "painting:" << tPaint;
-    shapeProcessor->printPerfCounters();
-
-    delete statuses;
-    setNeighbours(cols, rows);
     emit loaded();
-    QCoreApplication::instance()->processEvents();
-
     QTimer::singleShot(1000, this, SLOT(shuffle()));
-    return true;
 }
 
 void PuzzleGame::shuffle()
 {
-    QParallelAnimationGroup *group = new QParallelAnimationGroup();
     QEasingCurve easingCurve(QEasingCurve::OutElastic);
     int maxExplosions = MIN(_puzzleItems.count() / 4, 6);
     int maxDuration = maxExplosions * 600;
     easingCurve.setPeriod(3);
     easingCurve.setAmplitude(2.2);
 
+    PuzzleAnimation *animation = new PuzzleAnimation(this, easingCurve);
+    animation->reserve(_puzzleItems.count());
+
     foreach (PuzzlePiece *item, _puzzleItems)
     {
         int pauseDuration = randomInt(0, maxExplosions) * 350;
+        QPointF midPos(randomInt(_unit.width(), width() - _unit.width()), randomInt(_unit.height(), height() - _unit.height()));
+        QPointF endPos(randomInt(_unit.width(), width() - _unit.width()), randomInt(_unit.height(), height() - _unit.height()));
+        int endRotation = _allowRotation ? randomInt(0, 359) : 0;
+        int midRotation = randomInt(0, 359);
 
-        QSequentialAnimationGroup *seq = new QSequentialAnimationGroup(group);
-        group->addAnimation(seq);
-        QParallelAnimationGroup *par = new QParallelAnimationGroup(seq);
-        seq->addPause(pauseDuration);
-        seq->addAnimation(par);
-
-        QPropertyAnimation *anim = new QPropertyAnimation(item, "pos", group);
-        anim->setStartValue(item->pos());
-        anim->setKeyValueAt(0.5, QPointF(randomInt(_unit.width(), width() - _unit.width()), randomInt(_unit.height(), height() - _unit.height())));
-        anim->setEndValue(QPointF(randomInt(_unit.width(), width() - _unit.width()), randomInt(_unit.height(), height() - _unit.height())));
-        anim->setDuration(maxDuration - pauseDuration);
-        anim->setEasingCurve(easingCurve);
-        par->addAnimation(anim);
-
-        QPropertyAnimation *rotateAnimation = new QPropertyAnimation(item, "rotation", group);
-        rotateAnimation->setStartValue(item->rotation());
-        rotateAnimation->setEndValue(_allowRotation ? randomInt(0, 359) : 0);
-        rotateAnimation->setKeyValueAt(0.5, randomInt(0, 359));
-        rotateAnimation->setDuration(maxDuration - pauseDuration);
-        rotateAnimation->setEasingCurve(easingCurve);
-        par->addAnimation(rotateAnimation);
+        animation->addPiece(item, midPos, midRotation, endPos, endRotation, maxDuration - pauseDuration, pauseDuration);
 
         if (randomInt(0, 2))
             item->raise();
     }
 
     emit this->animationStarting();
-    connect(group, SIGNAL(finished()), this, SIGNAL(animationStopped()));
-    connect(group, SIGNAL(finished()), this, SLOT(enable()));
-    connect(group, SIGNAL(finished()), this, SIGNAL(gameStarted()));
-    group->start(QAbstractAnimation::DeleteWhenStopped);
+    connect(animation, SIGNAL(finished()), this, SIGNAL(animationStopped()));
+    connect(animation, SIGNAL(finished()), this, SLOT(enable()));
+    connect(animation, SIGNAL(finished()), this, SIGNAL(gameStarted()));
+    animation->start(QAbstractAnimation::DeleteWhenStopped);
 }
 
 void PuzzleGame::assemble()
 {
     qDebug() << "assemble called, number of items:" << _puzzleItems.count();
-    QParallelAnimationGroup *group = new QParallelAnimationGroup();
-    QEasingCurve easingCurve(QEasingCurve::OutExpo);
+    PuzzleAnimation *animation = new PuzzleAnimation(this, QEasingCurve(QEasingCurve::OutExpo));
+    animation->reserve(_puzzleItems.count());
     _restorablePositions.clear();
     disable();
 
     foreach (PuzzlePiece *item, _puzzleItems)
     {
         _restorablePositions[item] = QPair<QPointF, int>(item->pos(), item->rotation());
-
-        QPropertyAnimation *anim = new QPropertyAnimation(item, "pos", group);
-        anim->setStartValue(item->pos());
-        anim->setEndValue(item->supposedPosition());
-        anim->setDuration(2000);
-        anim->setEasingCurve(easingCurve);
-        group->addAnimation(anim);
-
-        QPropertyAnimation *rotateAnimation = new QPropertyAnimation(item, "rotation", group);
-        rotateAnimation->setStartValue(item->rotation());
-        rotateAnimation->setEndValue(0);
-        rotateAnimation->setDuration(2000);
-        rotateAnimation->setEasingCurve(easingCurve);
-        group->addAnimation(rotateAnimation);
+        animation->addPiece(item, item->supposedPosition(), 0, 2000);
     }
 
     if (_puzzleItems.count() == 1)
     {
         setRotationGuideCoordinates(defaultRotationGuideCoordinates);
         emit this->gameAboutToBeWon();
-        connect(group, SIGNAL(finished()), this, SIGNAL(gameWon()));
+        connect(animation, SIGNAL(finished()), this, SIGNAL(gameWon()));
     }
     else
     {
-        connect(group, SIGNAL(finished()), this, SIGNAL(assembleComplete()));
+        connect(animation, SIGNAL(finished()), this, SIGNAL(assembleComplete()));
     }
 
     emit this->animationStarting();
-    connect(group, SIGNAL(finished()), this, SIGNAL(animationStopped()));
-    group->start(QAbstractAnimation::DeleteWhenStopped);
+    connect(animation, SIGNAL(finished()), this, SIGNAL(animationStopped()));
+    animation->start(QAbstractAnimation::DeleteWhenStopped);
 }
 
 void PuzzleGame::restore()
@@ -351,31 +300,17 @@ void PuzzleGame::restore()
         return;
     }
 
-    QParallelAnimationGroup *group = new QParallelAnimationGroup();
-    QEasingCurve easingCurve(QEasingCurve::InExpo);
+    PuzzleAnimation *animation = new PuzzleAnimation(this, QEasingCurve(QEasingCurve::InExpo));
+    animation->reserve(_puzzleItems.count());
 
     foreach (PuzzlePiece *item, _puzzleItems)
-    {
-        QPropertyAnimation *anim = new QPropertyAnimation(item, "pos", group);
-        anim->setStartValue(item->pos());
-        anim->setEndValue(_restorablePositions[item].first);
-        anim->setDuration(2000);
-        anim->setEasingCurve(easingCurve);
-        group->addAnimation(anim);
-
-        QPropertyAnimation *rotateAnimation = new QPropertyAnimation(item, "rotation", group);
-        rotateAnimation->setStartValue(item->rotation());
-        rotateAnimation->setEndValue(_restorablePositions[item].second);
-        rotateAnimation->setDuration(2000);
-        rotateAnimation->setEasingCurve(easingCurve);
-        group->addAnimation(rotateAnimation);
-    }
+        animation->addPiece(item, _restorablePositions[item].first, _restorablePositions[item].second, 2000);
 
     emit this->animationStarting();
-    connect(group, SIGNAL(finished()), this, SIGNAL(animationStopped()));
-    connect(group, SIGNAL(finished()), this, SLOT(enable()));
-    connect(group, SIGNAL(finished()), this, SIGNAL(restoreComplete()));
-    group->start(QAbstractAnimation::DeleteWhenStopped);
+    connect(animation, SIGNAL(finished()), this, SIGNAL(animationStopped()));
+    connect(animation, SIGNAL(finished()), this, SLOT(enable()));
+    connect(animation, SIGNAL(finished()), this, SIGNAL(restoreComplete()));
+    animation->start(QAbstractAnimation::DeleteWhenStopped);
 }
 
 void PuzzleGame::enable()
@@ -390,22 +325,200 @@ void PuzzleGame::disable()
 
 void PuzzleGame::deleteAllPieces()
 {
+    cancelLoading();
+
+    // The running animations only run out, because the ids of their pieces will be reused
+    foreach (PuzzleAnimation *animation, findChildren<PuzzleAnimation*>())
+        animation->clear();
+
+    foreach (PuzzlePiece *item, _puzzleItems)
+        emit pieceRemoved(item);
     qDeleteAll(_puzzleItems);
     _puzzleItems.clear();
     _restorablePositions.clear();
+    _bottomPiece = _topPiece = 0;
+    _topZValue = 0;
+    _touchOwners.resize(0);
+    setBoardSize(0, 0);
+
+    // The ids of the pieces start over, so the flattening in progress is thrown away
+    delete _flattener;
+    _flattener = 0;
+    _flattenQueue.clear();
+    _flattenTimer->stop();
+}
+
+// Removes the piece from the z ordered list
+void PuzzleGame::unlinkPuzzleItem(PuzzlePiece *item)
+{
+    if (item->_pieceBelow)
+        item->_pieceBelow->_pieceAbove = item->_pieceAbove;
+    else if (_bottomPiece == item)
+        _bottomPiece = item->_pieceAbove;
+
+    if (item->_pieceAbove)
+        item->_pieceAbove->_pieceBelow = item->_pieceBelow;
+    else if (_topPiece == item)
+        _topPiece = item->_pieceBelow;
+
+    item->_pieceBelow = item->_pieceAbove = 0;
+}
+
+// Appends the piece to the top of the z ordered list
+void PuzzleGame::linkPuzzleItemOnTop(PuzzlePiece *item)
+{
+    item->_pieceBelow = _topPiece;
+    if (_topPiece)
+        _topPiece->_pieceAbove = item;
+    else
+        _bottomPiece = item;
+    _topPiece = item;
+    _pieceStore.z[item->index()] = ++_topZValue;
+}
+
+// NOTE: the puzzle coordinates of the item must be set before adding it
+void PuzzleGame::addPuzzleItem(PuzzlePiece *item)
+{
+    int x = item->puzzleCoordinates().x(), y = item->puzzleCoordinates().y();
+
+    if (_pieces.count() <= item->index())
+        _pieces.resize(item->index() + 1);
+    _pieces[item->index()] = item;
+    _puzzleItems.insert(item);
+    _spatialIndex.insert(item);
+
+    // New pieces go on top of the others
+    linkPuzzleItemOnTop(item);
+
+    if (x >= 0 && y >= 0 && x < _boardCols && y < _boardRows)
+        _pieceGrid[x * _boardRows + y] = item->index();
+
+    emit pieceAdded(item);
 }
 
 void PuzzleGame::removePuzzleItem(PuzzlePiece *item)
 {
+    if (item->index() >= 0 && item->index() < _pieces.count() && _pieces[item->index()] == item)
+        _pieces[item->index()] = 0;
+
     _puzzleItems.remove(item);
+    _spatialIndex.remove(item);
+    _pieceStore.flags[item->index()] &= ~PuzzlePieceStore::Alive;
+    unlinkPuzzleItem(item);
+
+    // Stop the animations of the piece (eg. from verifyPosition), they would keep moving it until it's deleted
+    foreach (QPropertyAnimation *animation, item->findChildren<QPropertyAnimation*>())
+        animation->stop();
+
+    // Forget the touch points of the piece (the merged pieces give them to the other piece first)
+    for (int i = _touchOwners.count() - 1; i >= 0; i--)
+    {
+        if (_touchOwners[i].piece == item)
+        {
+            _touchOwners[i] = _touchOwners.last();
+            _touchOwners.remove(_touchOwners.count() - 1);
+        }
+    }
+    emit pieceRemoved(item);
     item->deleteLater();
 }
 
+// Puts the piece on top of the others.
+// ----------
+// Only the raised piece gets a new z value (bigger than any other), so the relative
+// order of the other pieces stays the same without renumbering them.
+// NOTE: the z values grow with every raise, but it takes billions of raises to overflow
+// ----------
+void PuzzleGame::raisePuzzleItem(PuzzlePiece *item)
+{
+    if (item == _topPiece || !_puzzleItems.contains(item))
+        return;
+
+    unlinkPuzzleItem(item);
+    linkPuzzleItemOnTop(item);
+
+    emit pieceRaised(item);
+}
+
+// Schedules a merged group to be flattened into a single primitive
+void PuzzleGame::flattenLater(PuzzlePiece *item)
+{
+    _flattenQueue.insert(item->index());
+
+    if (!_flattenTimer->isActive())
+        _flattenTimer->start();
+}
+
+// Flattens the merged groups in the background.
+// ----------
+// A group is only flattened when it's not dragged, so that it isn't flattened again and again
+// while it's merged with more pieces. The images are gathered here on the GUI thread, and the
+// results are only applied if the group hasn't changed while it was flattened.
+// ----------
+void PuzzleGame::onFlattenTimer()
+{
+    if (_flattener)
+    {
+        if (!_flattener->isFinished())
+            return;
+
+        for (int i = 0; i < _flattener->jobs().count(); i++)
+        {
+            const Puzzle::Creation::FlattenJob &job = _flattener->jobs().at(i);
+            PuzzlePiece *item = _pieces.value(job.piece, 0);
+            if (item && item->primitivesVersion() == job.version)
+                item->setFlattened(_flattener->results().at(i));
+        }
+
+        delete _flattener;
+        _flattener = 0;
+    }
+
+    QVector<Puzzle::Creation::FlattenJob> jobs;
+    foreach (int id, _flattenQueue)
+    {
+        PuzzlePiece *item = _pieces.value(id, 0);
+        if (item && item->dragging())
+            continue;
+
+        _flattenQueue.remove(id);
+        if (!item || item->primitives().count() < 2)
+            continue;
+
+        Puzzle::Creation::FlattenJob job;
+        job.piece = id;
+        job.version = item->primitivesVersion();
+        job.layers.reserve(item->primitives().count());
+
+        foreach (const PuzzlePiecePrimitive *pr, item->primitives())
+        {
+            Puzzle::Creation::FlattenLayer layer;
+            layer.stroke = pr->strokeImage();
+            layer.pixmap = pr->pixmap().toImage();
+            layer.strokeOffset = pr->strokeOffset();
+            layer.pixmapOffset = pr->pixmapOffset();
+            layer.hitMask = pr->hitMask();
+            layer.usabilityRects = pr->usabilityRects();
+            job.layers.append(layer);
+        }
+
+        jobs.append(job);
+    }
+
+    if (jobs.count())
+    {
+        _flattener = new Puzzle::Creation::GroupFlattener(jobs);
+        _flattener->start();
+    }
+    else if (_flattenQueue.isEmpty())
+    {
+        _flattenTimer->stop();
+    }
+}
+
 void PuzzleGame::handleMousePress(Qt::MouseButton button, QPointF pos)
 {
-    QList<PuzzlePiece*> puzzleItems = _puzzleItems.toList();
-    qSort(puzzleItems.begin(), puzzleItems.end(), PuzzlePiece::puzzleItemDescLessThan);
-    _mouseSubject = findPuzzleItem(pos, puzzleItems);
+    _mouseSubject = findPuzzleItem(pos);
 
     if (!_enabled || !_mouseSubject || _mouseSubject->isDraggingWithTouch())
     {
@@ -462,57 +575,125 @@ void PuzzleGame::handleMouseMove(QPointF pos)
     _mouseSubject->checkMergeableSiblings();
 }
 
+// Finds the touch point with the given id, there are only a few of them so this is fast
+static const QTouchEvent::TouchPoint *findTouchPoint(const QList<QTouchEvent::TouchPoint> &touchPoints, int id)
+{
+    for (int i = 0; i < touchPoints.count(); i++)
+        if (touchPoints.at(i).id() == id)
+            return &touchPoints.at(i);
+
+    return 0;
+}
+
+// Returns the index of the touch point in the ownership table, or -1 if no piece has grabbed it
+int PuzzleGame::findTouchOwner(int id) const
+{
+    for (int i = 0; i < _touchOwners.count(); i++)
+        if (_touchOwners[i].id == id)
+            return i;
+
+    return -1;
+}
+
+// Takes the touch point away from its piece, the piece is still handled in the current event
+void PuzzleGame::releaseTouchOwner(int index)
+{
+    PuzzlePiece *item = _touchOwners[index].piece;
+    item->ungrabTouchPoint(_touchOwners[index].id);
+    touchPiece(item);
+
+    // The order of the table doesn't matter, so the last one can take its place
+    _touchOwners[index] = _touchOwners.last();
+    _touchOwners.remove(_touchOwners.count() - 1);
+}
+
+// Gives the touch points of a piece to another one, when they are merged
+void PuzzleGame::transferTouchPoints(PuzzlePiece *from, PuzzlePiece *to)
+{
+    for (int i = 0; i < _touchOwners.count(); i++)
+        if (_touchOwners[i].piece == from)
+            _touchOwners[i].piece = to;
+}
+
+// Makes the piece handled in the current touch event
+void PuzzleGame::touchPiece(PuzzlePiece *item)
+{
+    if (!_touchedPieces.contains(item))
+        _touchedPieces.append(item);
+}
+
+// Handles the touch points of the event.
+// ----------
+// Every touch point belongs to the piece which was under it when it was pressed, this is kept
+// in the ownership table. Only the pieces which own a touch point (or have just lost one)
+// are handled, so the cost depends on the number of touch points, not the number of pieces.
+// NOTE: this is called for every touch event, so it must not allocate memory
+// (the ownership table and the hit test reuse their vectors), except when pieces are merged.
+// ----------
 void PuzzleGame::handleTouchEvent(QTouchEvent *event)
 {
     if (!_enabled)
         return;
 
-    // Determine which touch point belongs to which puzzle item.
+    const QList<QTouchEvent::TouchPoint> &touchPoints = event->touchPoints();
+    _touchedPieces.resize(0);
 
-    QList<PuzzlePiece*> puzzleItems = _puzzleItems.toList();
-    qSort(puzzleItems.begin(), puzzleItems.end(), PuzzlePiece::puzzleItemDescLessThan);
+    // Remove all non-existent touch points (they might exist on a glitchy touchscreen)
+    for (int i = _touchOwners.count() - 1; i >= 0; i--)
+        if (!findTouchPoint(touchPoints, _touchOwners[i].id))
+            releaseTouchOwner(i);
 
     // Iterate through the touch points in the event and assign them to an item
 
-    QMap<int, const QTouchEvent::TouchPoint*> m;
-    foreach (const QTouchEvent::TouchPoint &p, event->touchPoints())
+    for (int i = 0; i < touchPoints.count(); i++)
     {
-        m.insert(p.id(), &p);
+        const QTouchEvent::TouchPoint &p = touchPoints.at(i);
+
         if (p.state() == Qt::TouchPointReleased)
         {
             //qDebug() << "released";
-            foreach (PuzzlePiece *item, puzzleItems)
-            {
-                item->ungrabTouchPoint(p.id());
-            }
+            int owner = findTouchOwner(p.id());
+            if (owner >= 0)
+                releaseTouchOwner(owner);
         }
         else if (p.state() == Qt::TouchPointPressed)
         {
             //qDebug() << "pressed";
-            PuzzlePiece *item = findPuzzleItem(p.pos(), puzzleItems);
+            int owner = findTouchOwner(p.id());
+            if (owner >= 0)
+                releaseTouchOwner(owner);
+
+            PuzzlePiece *item = findPuzzleItem(p.pos());
 
             if (item)
             {
                 item->grabTouchPoint(p.id());
                 item->raise();
+
+                TouchOwner newOwner = { p.id(), item };
+                _touchOwners.append(newOwner);
             }
         }
     }
 
     // For each item, handle the touch points it has grabbed
 
-    unsigned totalGrabbedTouchPoints = 0;
+    for (int i = 0; i < _touchOwners.count(); i++)
+        touchPiece(_touchOwners[i].piece);
 
-    foreach (PuzzlePiece *item, puzzleItems)
+    unsigned totalGrabbedTouchPoints = _touchOwners.count();
+
+    for (int k = 0; k < _touchedPieces.count(); k++)
     {
-        // Remove all non-existent touch points (they might exist on a glitchy touchscreen)
-        foreach (int id, item->grabbedTouchPointIds())
-            if (!m.contains(id))
-                item->ungrabTouchPoint(id);
+        PuzzlePiece *item = _touchedPieces[k];
+
+        // The item may have been merged into another one while handling the previous ones
+        if (!(_pieceStore.flags[item->index()] & PuzzlePieceStore::Alive))
+            continue;
 
         // Examine the current touch point count and decide what to do
-        int currentTouchPointCount = item->grabbedTouchPointIds().count();
-        totalGrabbedTouchPoints += currentTouchPointCount;
+        const QVector<int> &grabbed = item->grabbedTouchPointIds();
+        int currentTouchPointCount = grabbed.count();
         if (currentTouchPointCount == 0)
         {
             if (item->dragging())
@@ -522,9 +703,8 @@ void PuzzleGame::handleTouchEvent(QTouchEvent *event)
 
         // Calculate the midpoint of the item
         QPointF midPoint;
-        foreach (int id, item->grabbedTouchPointIds())
-            if (m.contains(id))
-                midPoint += m[id]->pos();
+        for (int i = 0; i < grabbed.count(); i++)
+            midPoint += findTouchPoint(touchPoints, grabbed.at(i))->pos();
         midPoint /= currentTouchPointCount;
         midPoint = item->mapFromParent(midPoint);
 
@@ -549,15 +729,17 @@ void PuzzleGame::handleTouchEvent(QTouchEvent *event)
             // Perform rotation
             if (allowRotation() && currentTouchPointCount >= 2)
             {
+                QPointF vector = findTouchPoint(touchPoints, grabbed.at(1))->screenPos() - findTouchPoint(touchPoints, grabbed.at(0))->screenPos();
+
                 if (item->previousTouchPointCount() < 2 || item->previousTouchPointCount() != currentTouchPointCount)
-                    item->startRotation(m[*(++item->grabbedTouchPointIds().begin())]->screenPos() - m[*(item->grabbedTouchPointIds().begin())]->screenPos());
+                    item->startRotation(vector);
                 else
-                    item->handleRotation(m[*(++item->grabbedTouchPointIds().begin())]->screenPos() - m[*(item->grabbedTouchPointIds().begin())]->screenPos());
+                    item->handleRotation(vector);
             }
         }
 
         // Take care of rotation guide
-        if (currentTouchPointCount == 1 && event->touchPoints().count() == 1)
+        if (currentTouchPointCount == 1 && touchPoints.count() == 1)
         {
             // If exactly one piece has exactly one touch point, let's say that is the "mouse subject"
             _mouseSubject = item;
@@ -570,12 +752,12 @@ void PuzzleGame::handleTouchEvent(QTouchEvent *event)
         }
 
         // Save previous touch point count
-        item->setPreviousTouchPointCount(item->grabbedTouchPointIds().count());
+        item->setPreviousTouchPointCount(grabbed.count());
         // Check mergeable neighbours of the piece
         item->checkMergeableSiblings();
     }
 
-    if (totalGrabbedTouchPoints == 0 && event->touchPoints().count() == 1 && event->touchPoints().at(0).state() == Qt::TouchPointPressed)
+    if (totalGrabbedTouchPoints == 0 && touchPoints.count() == 1 && touchPoints.at(0).state() == Qt::TouchPointPressed)
     {
         // User touched the board, remove guide
         setRotationGuideCoordinates(defaultRotationGuideCoordinates);
@@ -24,18 +24,34 @@
 #include <QPoint>
 #include <QPointF>
 #include <QSet>
+#include <QVector>
 
 #include "../helpers/util.h"
+#include "puzzlegameloader.h"
+#include "puzzlespatialindex.h"
+#include "puzzlepiecestore.h"
 
 class QTouchEvent;
+class QTimer;
 class PuzzlePiece;
+class PuzzlePiecePrimitive;
+
+namespace Puzzle
+{
+namespace Creation
+{
+class GroupFlattener;
+}
+}
 
 class PuzzleGame : public QObject
 {
     Q_OBJECT
+    friend class PuzzleGameLoader;
+    friend class PuzzlePiece;
     GENPROPERTY_S(bool, _enabled, enabled, setEnabled)
     GENPROPERTY_R(bool, _allowRotation, allowRotation)
-    GENPROPERTY_R(int, _strokeThickness, strokeThickness)
+    GENPROPERTY_S(int, _strokeThickness, strokeThickness, setStrokeThickness)
     GENPROPERTY_S(int, _width, width, setWidth)
     GENPROPERTY_S(int, _height, height, setHeight)
     GENPROPERTY_R(QSize, _unit, unit)
@@ -48,20 +64,70 @@ class PuzzleGame : public QObject
     GENPROPERTY_R(QSet<PuzzlePiece*>, _puzzleItems, puzzleItems)
     GENPROPERTY_F(QPointF, _rotationGuideCoordinates, rotationGuideCoordinates, setRotationGuideCoordinates, rotationGuideCoordinatesChanged)
     Q_PROPERTY(QPointF rotationGuideCoordinates READ rotationGuideCoordinates WRITE setRotationGuideCoordinates NOTIFY rotationGuideCoordinatesChanged)
+    GENPROPERTY_R(PuzzleGameLoader*, _loader, loader)
+    Q_PROPERTY(PuzzleGameLoader* loader READ loader NOTIFY loaderChanged)
+
+    // Every piece that was added, by their ids (the merged pieces are 0)
+    QVector<PuzzlePiece*> _pieces;
+    PuzzlePieceStore _pieceStore;
+    // The index of the piece in _pieces for every puzzle coordinate, column by column
+    QVector<int> _pieceGrid;
+    int _boardCols, _boardRows;
+    PuzzleSpatialIndex _spatialIndex;
+    QVector<PuzzlePiece*> _hitCandidates;
+    // The ends of the z ordered list of the pieces and the z value of the topmost piece
+    PuzzlePiece *_bottomPiece, *_topPiece;
+    int _topZValue;
+    // The merged groups which are waiting to be flattened (by their ids) and the flattening in progress
+    QSet<int> _flattenQueue;
+    Puzzle::Creation::GroupFlattener *_flattener;
+    QTimer *_flattenTimer;
+
+    // The piece which has grabbed each touch point, there are only a few of them, so this is a flat vector
+    struct TouchOwner
+    {
+        int id;
+        PuzzlePiece *piece;
+    };
+    QVector<TouchOwner> _touchOwners;
+    // The pieces which are handled in the current touch event (reused for every event)
+    QVector<PuzzlePiece*> _touchedPieces;
 
     QHash<PuzzlePiece*, QPair<QPointF, int> > _restorablePositions;
     PuzzlePiece *_mouseSubject;
     bool _rotatingWithGuide;
 
+    void unlinkPuzzleItem(PuzzlePiece *item);
+    void linkPuzzleItemOnTop(PuzzlePiece *item);
+    int findTouchOwner(int id) const;
+    void releaseTouchOwner(int index);
+    void transferTouchPoints(PuzzlePiece *from, PuzzlePiece *to);
+    void touchPiece(PuzzlePiece *item);
+
 public:
     explicit PuzzleGame(QObject *parent = 0);
-    Q_INVOKABLE bool startGame(const QString &imageUrl, int rows, int cols, bool allowRotation);
+    ~PuzzleGame();
+    Q_INVOKABLE PuzzleGameLoader *startGame(const QString &imageUrl, int rows, int cols, bool allowRotation);
+    Q_INVOKABLE void cancelLoading();
     Q_INVOKABLE void startRotateWithGuide(qreal x, qreal y);
     Q_INVOKABLE void rotateWithGuide(qreal x, qreal y);
     Q_INVOKABLE void stopRotateWithGuide();
+    void setBoardSize(int cols, int rows);
     void setNeighbours(int x, int y);
     PuzzlePiece *find(const QPoint &puzzleCoordinates);
+    void addPuzzleItem(PuzzlePiece *item);
     void removePuzzleItem(PuzzlePiece *item);
+    void raisePuzzleItem(PuzzlePiece *item);
+    void flattenLater(PuzzlePiece *item);
+    // NOTE: iterate the pieces from bottom to top with PuzzlePiece::pieceAbove()
+    PuzzlePiece *bottomPiece() const { return _bottomPiece; }
+    PuzzlePiece *topPiece() const { return _topPiece; }
+    PuzzleSpatialIndex &spatialIndex() { return _spatialIndex; }
+    PuzzlePieceStore &pieceStore() { return _pieceStore; }
+    const PuzzlePieceStore &pieceStore() const { return _pieceStore; }
+    PuzzlePiece *findPuzzleItem(const QPointF &p);
+    // NOTE: the items must be sorted in descending z order, the topmost item under the point is returned
+    static PuzzlePiece *findPuzzleItem(QPointF p, const QVector<PuzzlePiece*> &puzzleItems);
 
     void handleMousePress(Qt::MouseButton button, QPointF pos);
     void handleMouseRelease(Qt::MouseButton button, QPointF pos);
@@ -72,6 +138,7 @@ signals:
     void toleranceChanged();
     void rotationToleranceChanged();
     void rotationGuideCoordinatesChanged();
+    void loaderChanged();
 
     void animationStarting();
     void animationStopped();
@@ -79,11 +146,20 @@ signals:
     void gameWon();
     void gameAboutToBeWon();
     void loaded();
+    void loadFailed();
     void loadProgressChanged(int progress);
     void shuffleComplete();
     void assembleComplete();
     void restoreComplete();
     void newGameStarting();
+    // NOTE: these let the renderers update only the pieces which have changed
+    void pieceAdded(PuzzlePiece *piece);
+    void pieceRemoved(PuzzlePiece *piece);
+    void pieceRaised(PuzzlePiece *piece);
+    void pieceTransformationChanged(PuzzlePiece *piece);
+    void piecePrimitivesChanged(PuzzlePiece *piece);
+    // NOTE: the primitive is deleted right after this, it can only be used as a key
+    void primitiveAboutToBeDeleted(PuzzlePiecePrimitive *primitive);
     
 public slots:
     Q_INVOKABLE void disable();
@@ -95,6 +171,13 @@ public slots:
     void emitAnimationStarting() { emit this->animationStarting(); }
     void emitAnimationStopped() { emit this->animationStopped(); }
 
+private slots:
+    void onLoaderProgressChanged();
+    void onLoaderImageProcessed();
+    void onLoaderCanceled();
+    void onLoaderFinished(bool success);
+    void onFlattenTimer();
+
 };
 
 #endif // PUZZLEGAME_H
@@ -0,0 +1,436 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <QDebug>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+
+#include "puzzlegameloader.h"
+#include "puzzlegame.h"
+#include "puzzlepiece.h"
+#include "puzzlepieceprimitive.h"
+#include "creation/imageprocessor.h"
+#include "creation/shapeprocessor.h"
+#include "creation/puzzlecache.h"
+
+// Interval of checking on the background work, this is about one frame
+#define PUZZLEGAMELOADER_POLL_INTERVAL 16
+// Maximum time spent with creating piece objects in one go
+#define PUZZLEGAMELOADER_CREATION_BUDGET 8
+
+// The part of the loader which is shared with the image processing job,
+// because that may still run after the loader is deleted.
+struct PuzzleGameLoaderState
+{
+    QString imageUrl, cacheKey;
+    QSize viewportSize;
+    int rows, cols, strokeThickness;
+    unsigned seed;
+    qint64 decodeTime;
+    Puzzle::Creation::ImageProcessor *imageProcessor;
+    Puzzle::Creation::CachedPuzzle *cachedPuzzle;
+    QAtomicInt processed, canceled;
+
+    PuzzleGameLoaderState() : decodeTime(0), imageProcessor(0), cachedPuzzle(0) { }
+    ~PuzzleGameLoaderState() { delete imageProcessor; delete cachedPuzzle; }
+};
+
+class ImageProcessingJob : public QRunnable
+{
+    QSharedPointer<PuzzleGameLoaderState> _state;
+
+public:
+    explicit ImageProcessingJob(const QSharedPointer<PuzzleGameLoaderState> &state) : _state(state) { }
+
+    void run()
+    {
+        if (!_state->canceled.fetchAndAddRelaxed(0))
+        {
+            QElapsedTimer timer;
+            timer.start();
+            qDebug() << "trying to start game with" << _state->imageUrl;
+
+            // If the same game was already generated, it is loaded from the cache (with its tab layout)
+            _state->cacheKey = Puzzle::Creation::PuzzleCache::key(_state->imageUrl, _state->rows, _state->cols, _state->viewportSize, _state->strokeThickness);
+            _state->cachedPuzzle = Puzzle::Creation::PuzzleCache::load(_state->cacheKey, _state->rows, _state->cols);
+
+            if (_state->cachedPuzzle)
+            {
+                qDebug() << timer.elapsed() << "ms spent with loading the game from the cache";
+            }
+            else
+            {
+                _state->imageProcessor = new Puzzle::Creation::ImageProcessor(_state->imageUrl, _state->viewportSize, _state->rows, _state->cols, _state->strokeThickness);
+                qDebug() << timer.elapsed() << "ms spent with processing the image";
+            }
+
+            _state->decodeTime = timer.elapsed();
+        }
+
+        _state->processed.fetchAndStoreOrdered(1);
+    }
+};
+
+class PuzzleCacheStoreJob : public QRunnable
+{
+    QString _key;
+    Puzzle::Creation::GameDescriptor _descriptor;
+    unsigned _seed;
+    QVector<int> _statuses;
+    QVector<QImage> _pieces;
+
+public:
+    PuzzleCacheStoreJob(const QString &key, const Puzzle::Creation::GameDescriptor &descriptor, unsigned seed, const QVector<int> &statuses, const QVector<QImage> &pieces)
+        : _key(key), _descriptor(descriptor), _seed(seed), _statuses(statuses), _pieces(pieces) { }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        Puzzle::Creation::PuzzleCache::store(_key, _descriptor, _seed, _statuses, _pieces);
+        qDebug() << timer.elapsed() << "ms spent with storing the game in the cache";
+    }
+};
+
+// The shapes of the previous game are reused if the pieces have the same size.
+static Puzzle::Creation::ShapeProcessor *getShapeProcessor(const Puzzle::Creation::GameDescriptor &desc)
+{
+    static int previousRows = desc.rows, previousCols = desc.cols, previousPixmapW = desc.pixmapSize.width(), previousPixmapH = desc.pixmapSize.height();
+    static Puzzle::Creation::ShapeProcessor *shapeProcessor = new Puzzle::Creation::ShapeProcessor(desc);
+
+    if (previousRows != desc.rows || previousCols != desc.cols || previousPixmapW != desc.pixmapSize.width() || previousPixmapH != desc.pixmapSize.height())
+    {
+        delete shapeProcessor;
+        shapeProcessor = new Puzzle::Creation::ShapeProcessor(desc);
+    }
+
+    previousRows = desc.rows, previousCols = desc.cols, previousPixmapW = desc.pixmapSize.width(), previousPixmapH = desc.pixmapSize.height();
+    return shapeProcessor;
+}
+
+PuzzleGameLoader::PuzzleGameLoader(PuzzleGame *game, const QString &imageUrl, int rows, int cols)
+    : QObject(game)
+    , _progress(0)
+    , _total(rows * cols)
+    , _running(false)
+    , _canceled(false)
+    , _game(game)
+    , _state(new PuzzleGameLoaderState())
+    , _generator(0)
+    , _rows(rows)
+    , _cols(cols)
+    , _createdPieces(0)
+{
+    _state->imageUrl = imageUrl;
+    _state->viewportSize = QSize(game->width(), game->height());
+    _state->rows = rows;
+    _state->cols = cols;
+    _state->strokeThickness = game->strokeThickness();
+
+    // A new game gets a random tab layout, but if it's in the cache, its layout is used instead, see poll()
+    // NOTE: qrand() is seeded per thread, so this must happen on the GUI thread
+    _state->seed = ((unsigned) qrand() << 16) ^ (unsigned) qrand();
+    _statuses.fill(0, rows * cols);
+    Puzzle::Creation::generatePuzzlePieceStatuses(rows, cols, _statuses.data(), _state->seed);
+
+    _poller = new QTimer(this);
+    _poller->setInterval(PUZZLEGAMELOADER_POLL_INTERVAL);
+    connect(_poller, SIGNAL(timeout()), this, SLOT(poll()));
+}
+
+PuzzleGameLoader::~PuzzleGameLoader()
+{
+    if (_generator)
+    {
+        _generator->cancel();
+        delete _generator;
+    }
+}
+
+void PuzzleGameLoader::start()
+{
+    _running = true;
+    emit runningChanged();
+
+    QThreadPool::globalInstance()->start(new ImageProcessingJob(_state));
+    _poller->start();
+}
+
+void PuzzleGameLoader::cancel()
+{
+    if (!_running)
+        return;
+
+    _poller->stop();
+    _state->canceled.fetchAndStoreOrdered(1);
+    if (_generator)
+        _generator->cancel();
+
+    _running = false;
+    _canceled = true;
+    emit runningChanged();
+    emit canceledChanged();
+}
+
+void PuzzleGameLoader::poll()
+{
+    // Waiting for the image to be processed
+    if (!_generator)
+    {
+        if (!_state->processed.fetchAndAddOrdered(0))
+            return;
+
+        _timings.decode = _state->decodeTime;
+        _timings.cached = _state->cachedPuzzle != 0;
+
+        if (_state->cachedPuzzle)
+        {
+            _descriptor = _state->cachedPuzzle->descriptor();
+            _state->seed = _state->cachedPuzzle->seed();
+            _statuses = _state->cachedPuzzle->statuses();
+        }
+        else if (_state->imageProcessor->isValid())
+        {
+            _descriptor = _state->imageProcessor->descriptor();
+        }
+        else
+        {
+            qDebug() << "pixmap is null, not starting game.";
+            finish(false);
+            return;
+        }
+
+        prepareJobs();
+        emit imageProcessed();
+
+        _generator = new Puzzle::Creation::PieceGenerator(_state->imageProcessor, _jobs);
+        _generator->start();
+        return;
+    }
+
+    // Waiting for the pieces to be painted
+    if (_createdPieces == 0 && !_generator->waitForDone(0))
+    {
+        int progress = _generator->finishedCount();
+
+        if (progress != _progress)
+        {
+            _progress = progress;
+            emit progressChanged();
+        }
+
+        return;
+    }
+
+    if (_progress != _total)
+    {
+        _progress = _total;
+        emit progressChanged();
+    }
+
+    _timings.paint = _generator->elapsed();
+
+    // Create the pieces, a bit in every frame
+    QElapsedTimer timer;
+    timer.start();
+    createPieces();
+    _timings.pieces += timer.elapsed();
+
+    if (_createdPieces == _total)
+    {
+        timer.restart();
+        _game->setNeighbours(_cols, _rows);
+        _timings.neighbours = timer.elapsed();
+
+        if (!_state->cachedPuzzle)
+            storeInCache();
+
+        finish(true);
+    }
+}
+
+void PuzzleGameLoader::prepareJobs()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const Puzzle::Creation::GameDescriptor &desc = _descriptor;
+    Puzzle::Creation::ShapeProcessor *shapeProcessor = getShapeProcessor(desc);
+    shapeProcessor->resetPerfCounters();
+
+    _game->_tabSize = desc.tabSize;
+    _game->_tabOffset = desc.tabOffset;
+    _game->_unit = desc.unitSize;
+    _game->setBoardSize(_cols, _rows);
+
+    // NOTE: the shape processor has a cache which is not thread-safe,
+    //       so the masks and shapes are looked up here and the workers get their own copies.
+    //       The masks are implicitly shared, so this is cheap.
+
+    _jobs.reserve(_total);
+
+    for (int i = 0; i < _cols; i++)
+    {
+        for (int j = 0; j < _rows; j++)
+        {
+            Puzzle::Creation::PieceJob job;
+            job.i = i;
+            job.j = j;
+            job.status = _statuses[i * _rows + j];
+            job.corr = shapeProcessor->getCorrectionFor(job.status);
+
+            // The pieces which are in the cache don't need a mask
+            if (_state->cachedPuzzle)
+                job.cachedPiece = _state->cachedPuzzle->piece(_jobs.count());
+            else
+                job.mask = shapeProcessor->getPuzzlePieceMask(job.status);
+
+            if (!_hitMasks.contains(job.status))
+                _hitMasks.insert(job.status, shapeProcessor->getPuzzlePieceHitMask(job.status));
+
+            _jobs.append(job);
+        }
+    }
+
+    prepareStrokes(shapeProcessor);
+
+    _timings.shape = timer.elapsed();
+    qDebug() << _timings.shape << "ms spent with creating shapes";
+    shapeProcessor->printPerfCounters();
+}
+
+void PuzzleGameLoader::prepareStrokes(Puzzle::Creation::ShapeProcessor *shapeProcessor)
+{
+    // The strokes are only painted once for every canonical status,
+    // the other statuses use the same pixmap (or before Qt 5.6, a flipped copy of it).
+    QHash<int, QImage> canonicalStrokes;
+#ifdef PUZZLEPIECEPRIMITIVE_CANONICAL_STROKES
+    QHash<int, QPixmap> canonicalPixmaps;
+#endif
+
+    foreach (const Puzzle::Creation::PieceJob &job, _jobs)
+    {
+        if (_strokes.contains(job.status))
+            continue;
+
+        PuzzleGameLoaderStroke stroke;
+        stroke.info = shapeProcessor->getStrokeInfo(job.status);
+
+        if (!canonicalStrokes.contains(stroke.info.canonicalStatus))
+            canonicalStrokes.insert(stroke.info.canonicalStatus, Puzzle::Creation::ImageProcessor::drawStroke(shapeProcessor->getPuzzlePieceStrokeMask(job.status)));
+
+        const QImage &canonical = canonicalStrokes[stroke.info.canonicalStatus];
+
+#ifdef PUZZLEPIECEPRIMITIVE_CANONICAL_STROKES
+        if (!canonicalPixmaps.contains(stroke.info.canonicalStatus))
+            canonicalPixmaps.insert(stroke.info.canonicalStatus, QPixmap::fromImage(canonical));
+
+        stroke.pixmap = canonicalPixmaps[stroke.info.canonicalStatus];
+#else
+        if (stroke.info.flip == Puzzle::Creation::ExactMatch)
+            stroke.pixmap = QPixmap::fromImage(canonical);
+        else
+            stroke.pixmap = QPixmap::fromImage(canonical.mirrored(stroke.info.flip != Puzzle::Creation::VerticalFlipMatch,
+                                                                  stroke.info.flip != Puzzle::Creation::HorizontalFlipMatch));
+#endif
+
+        _strokes.insert(job.status, stroke);
+    }
+}
+
+void PuzzleGameLoader::createPieces()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const Puzzle::Creation::GameDescriptor &desc = _descriptor;
+    const QVector<Puzzle::Creation::PieceResult> &results = _generator->results();
+    qreal   w0 = (desc.viewportSize.width() - desc.cols * desc.unitSize.width()) / 2,
+            h0 = (desc.viewportSize.height() - desc.rows * desc.unitSize.height()) / 2;
+
+    for (; _createdPieces < _total && timer.elapsed() < PUZZLEGAMELOADER_CREATION_BUDGET; _createdPieces++)
+    {
+        const Puzzle::Creation::PieceJob &job = _jobs.at(_createdPieces);
+        const Puzzle::Creation::PieceResult &result = results.at(_createdPieces);
+
+        QPointF supposed(w0 + (job.i * desc.unitSize.width()) + job.corr.sxCorrection,
+                         h0 + (job.j * desc.unitSize.height()) + job.corr.syCorrection);
+
+        // Create the puzzle piece primitive
+        PuzzlePiecePrimitive *primitive = new PuzzlePiecePrimitive();
+        primitive->setPixmap(QPixmap::fromImage(result.piece));
+        primitive->setPixmapOffset(QPoint(0, 0));
+
+        // The pieces with the same status share their stroke
+        const PuzzleGameLoaderStroke &stroke = _strokes[job.status];
+        primitive->setStroke(stroke.pixmap);
+        primitive->setStrokeOffset(primitive->pixmapOffset() + stroke.info.offset);
+        primitive->setStrokeKey(stroke.info.canonicalStatus);
+        primitive->setStrokeMirror(stroke.info.flip);
+        primitive->setHitMask(_hitMasks[job.status]);
+        primitive->setUsabilityRects(QVector<QRectF>() << Puzzle::Creation::getUsabilityRect(desc, job.corr));
+
+        // Creating the piece item
+        PuzzlePiece *item = new PuzzlePiece(_game);
+        item->addPrimitive(primitive, QPointF(0, 0));
+        item->setPuzzleCoordinates(QPoint(job.i, job.j));
+        item->setSupposedPosition(supposed);
+        item->setPos(supposed);
+        item->setTabStatus(job.status);
+
+        item->setTransformOriginPoint(QPointF(randomInt(0, desc.unitSize.width()), randomInt(0, desc.unitSize.height())));
+
+        connect(item, SIGNAL(noNeighbours()), _game, SLOT(assemble()));
+        _game->addPuzzleItem(item);
+    }
+}
+
+void PuzzleGameLoader::storeInCache()
+{
+    // The cache has no key when it's disabled, then nothing could ever be read back
+    if (_state->cacheKey.isEmpty())
+        return;
+
+    QVector<QImage> pieces;
+    pieces.reserve(_total);
+
+    foreach (const Puzzle::Creation::PieceResult &result, _generator->results())
+        pieces.append(result.piece);
+
+    // NOTE: the images are implicitly shared and never modified, so they can be written on another thread
+    QThreadPool::globalInstance()->start(new PuzzleCacheStoreJob(_state->cacheKey, _descriptor, _state->seed, _statuses, pieces));
+}
+
+void PuzzleGameLoader::finish(bool success)
+{
+    _poller->stop();
+
+    // Free everything that was only needed for loading
+    delete _generator;
+    _generator = 0;
+    _jobs.clear();
+    _strokes.clear();
+    _hitMasks.clear();
+    _state.clear();
+
+    _running = false;
+    emit runningChanged();
+    emit finished(success);
+}
@@ -0,0 +1,107 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef PUZZLEGAMELOADER_H
+#define PUZZLEGAMELOADER_H
+
+#include <QObject>
+#include <QVector>
+#include <QSharedPointer>
+#include <QHash>
+#include <QPixmap>
+
+#include "../helpers/util.h"
+#include "creation/piecegenerator.h"
+#include "creation/shapeprocessor.h"
+
+class QTimer;
+class PuzzleGame;
+struct PuzzleGameLoaderState;
+
+// The stroke of the pieces with a given status
+struct PuzzleGameLoaderStroke
+{
+    QPixmap pixmap;
+    Puzzle::Creation::StrokeInfo info;
+};
+
+// How long the phases of the loading took, in milliseconds
+struct PuzzleGameLoaderTimings
+{
+    qint64 decode, shape, paint, pieces, neighbours;
+    bool cached;
+
+    PuzzleGameLoaderTimings() : decode(0), shape(0), paint(0), pieces(0), neighbours(0), cached(false) { }
+};
+
+// Loads a new game in the background.
+// ----------
+// The image is processed and the pieces are painted on the thread pool,
+// or if the same game was generated before, the pieces are loaded from the cache.
+// The GUI thread only checks on them once per frame, so it never has to pump
+// events while loading, and the progress is reported at most once per frame.
+// QML can observe the loading through this object and cancel it.
+// ----------
+class PuzzleGameLoader : public QObject
+{
+    Q_OBJECT
+    GENPROPERTY_R(int, _progress, progress)
+    Q_PROPERTY(int progress READ progress NOTIFY progressChanged)
+    GENPROPERTY_R(int, _total, total)
+    Q_PROPERTY(int total READ total CONSTANT)
+    GENPROPERTY_R(bool, _running, running)
+    Q_PROPERTY(bool running READ running NOTIFY runningChanged)
+    GENPROPERTY_R(bool, _canceled, canceled)
+    Q_PROPERTY(bool canceled READ canceled NOTIFY canceledChanged)
+    GENPROPERTY_R(PuzzleGameLoaderTimings, _timings, timings)
+
+    PuzzleGame *_game;
+    QSharedPointer<PuzzleGameLoaderState> _state;
+    Puzzle::Creation::PieceGenerator *_generator;
+    QVector<Puzzle::Creation::PieceJob> _jobs;
+    QVector<int> _statuses;
+    QHash<int, PuzzleGameLoaderStroke> _strokes;
+    QHash<int, Puzzle::Creation::HitMask> _hitMasks;
+    Puzzle::Creation::GameDescriptor _descriptor;
+    QTimer *_poller;
+    int _rows, _cols, _createdPieces;
+
+    void prepareJobs();
+    void prepareStrokes(Puzzle::Creation::ShapeProcessor *shapeProcessor);
+    void createPieces();
+    void storeInCache();
+    void finish(bool success);
+
+public:
+    explicit PuzzleGameLoader(PuzzleGame *game, const QString &imageUrl, int rows, int cols);
+    ~PuzzleGameLoader();
+    void start();
+    Q_INVOKABLE void cancel();
+
+signals:
+    void progressChanged();
+    void runningChanged();
+    void canceledChanged();
+    void imageProcessed();
+    void finished(bool success);
+
+private slots:
+    void poll();
+
+};
+
+#endif // PUZZLEGAMELOADER_H
@@ -64,14 +64,67 @@ bool PuzzlePiece::puzzleItemAscLessThan(PuzzlePiece *a, PuzzlePiece *b)
 
 PuzzlePiece::PuzzlePiece(PuzzleGame *parent)
     : QObject(parent)
-    , _rotation(0)
-    , _zValue(0)
+    , _pieceBelow(0)
+    , _pieceAbove(0)
     , _previousTouchPointCount(0)
-    , _dragging(false)
     , _isRightButtonPressed(false)
-    , _isDraggingWithTouch(false)
-    , _isEnabled(true)
+    , _primitivesVersion(0)
+    , _indexed(false)
+    , _indexDirty(false)
 {
+    _store = &parent->pieceStore();
+    _index = _store->add();
+}
+
+PuzzlePiece::~PuzzlePiece()
+{
+    qDeleteAll(_primitives);
+}
+
+void PuzzlePiece::setFlag(PuzzlePieceStore::Flag flag, bool on)
+{
+    if (on)
+        _store->flags[_index] |= flag;
+    else
+        _store->flags[_index] &= ~flag;
+}
+
+// Tells the spatial index of the game that this piece needs to be put into other cells
+// and the renderer that the transformation of this piece has to be updated
+void PuzzlePiece::markMoved()
+{
+    // NOTE: a removed piece may still be moved until it's deleted, but the renderers must not hear of it anymore
+    PuzzleGame *game = static_cast<PuzzleGame*>(parent());
+    if (game && (_store->flags.at(_index) & PuzzlePieceStore::Alive))
+    {
+        game->spatialIndex().markDirty(this);
+        emit game->pieceTransformationChanged(this);
+    }
+}
+
+void PuzzlePiece::setPos(const QPointF &pos)
+{
+    _store->x[_index] = pos.x();
+    _store->y[_index] = pos.y();
+    markMoved();
+}
+
+void PuzzlePiece::setRotation(qreal rotation)
+{
+    _store->rotation[_index] = rotation;
+    markMoved();
+}
+
+// The bounding rectangle of the rotated piece, in parent coordinates
+QRectF PuzzlePiece::boundingRect() const
+{
+    QPointF p1 = mapToParent(_shapeBounds.topLeft()),
+            p2 = mapToParent(_shapeBounds.topRight()),
+            p3 = mapToParent(_shapeBounds.bottomLeft()),
+            p4 = mapToParent(_shapeBounds.bottomRight());
+
+    return QRectF(QPointF(myMin<qreal>(myMin<qreal>(p1.x(), p2.x()), myMin<qreal>(p3.x(), p4.x())), myMin<qreal>(myMin<qreal>(p1.y(), p2.y()), myMin<qreal>(p3.y(), p4.y()))),
+                  QPointF(myMax<qreal>(myMax<qreal>(p1.x(), p2.x()), myMax<qreal>(p3.x(), p4.x())), myMax<qreal>(myMax<qreal>(p1.y(), p2.y()), myMax<qreal>(p3.y(), p4.y()))));
 }
 
 QPointF PuzzlePiece::centerPoint() const
@@ -104,20 +157,30 @@ void PuzzlePiece::mergeIfPossible(PuzzlePiece *item)
     }
 
     // Add the other items' primitives to this item
+    // NOTE: this only touches the primitives of the other item, the bounds of this item are extended incrementally
+    QPointF corr = item->supposedPosition() - this->supposedPosition();
     foreach (PuzzlePiecePrimitive *pr, item->_primitives)
-        this->addPrimitive(pr, item->supposedPosition() - this->supposedPosition());
+        this->insertPrimitive(pr, corr);
     item->_primitives.clear();
+    primitivesChanged();
 
-    static_cast<PuzzleGame*>(parent())->removePuzzleItem(item);
+    // Draw the group with a single primitive when it's not moving anymore
+    PuzzleGame *game = static_cast<PuzzleGame*>(parent());
+    game->flattenLater(this);
 
     // Grab the touch points of the other item
-    foreach (int id, item->_grabbedTouchPointIds)
-        this->_grabbedTouchPointIds.append(id);
+    this->_grabbedTouchPointIds += item->_grabbedTouchPointIds;
+    game->transferTouchPoints(item, this);
+
+    // The other item's group becomes part of this group, every live piece is the root of its group
+    game->removePuzzleItem(item);
+    _store->group[item->_index] = _index;
 
     // See if the puzzle is solved
     if (neighbours().count() == 0)
     {
-        _dragging = _isDraggingWithTouch = false;
+        setFlag(PuzzlePieceStore::Dragging, false);
+        setFlag(PuzzlePieceStore::DraggingWithTouch, false);
         qDebug() << "puzzle solved! :)";
         emit noNeighbours();
     }
@@ -126,23 +189,24 @@ void PuzzlePiece::mergeIfPossible(PuzzlePiece *item)
 void PuzzlePiece::startDrag(const QPointF &p, bool touch)
 {
     raise();
-    _dragging = true;
+    setFlag(PuzzlePieceStore::Dragging, true);
     _dragStart = mapToParent(p) - pos();
-    _isDraggingWithTouch = touch;
+    setFlag(PuzzlePieceStore::DraggingWithTouch, touch);
 }
 
 void PuzzlePiece::stopDrag()
 {
-    _dragging = _isDraggingWithTouch = false;
+    setFlag(PuzzlePieceStore::Dragging, false);
+    setFlag(PuzzlePieceStore::DraggingWithTouch, false);
     verifyPosition();
 }
 
 void PuzzlePiece::doDrag(const QPointF &position)
 {
-    if (!_isEnabled)
+    if (!isEnabled())
         return;
 
-    if (_dragging)
+    if (dragging())
         setPos(mapToParent(position) - _dragStart);
 }
 
@@ -153,7 +217,7 @@ void PuzzlePiece::startRotation(const QPointF &vector)
 
 void PuzzlePiece::handleRotation(const QPointF &v)
 {
-    if (!_isEnabled)
+    if (!isEnabled())
         return;
 
     qreal a = angle(v) * 180 / M_PI - _rotationStart;
@@ -186,7 +250,8 @@ void PuzzlePiece::setTransformOriginPoint(const QPointF &point)
     if (transformOriginPoint() != point)
     {
         QPointF compensation = mapToParent(QPointF(0, 0));
-        _transformOriginPoint = point;
+        _store->originX[_index] = point.x();
+        _store->originY[_index] = point.y();
         compensation -= mapToParent(QPointF(0, 0));
         setPos(pos() + compensation);
         _dragStart -= compensation;
@@ -212,8 +277,8 @@ void PuzzlePiece::verifyPosition()
             // bottom right of "bounding rect" (in parent coordinates)
             q(myMax<qreal>(myMax<qreal>(p1.x(), p2.x()), myMax<qreal>(p3.x(), p4.x())), myMax<qreal>(myMax<qreal>(p1.y(), p2.y()), myMax<qreal>(p3.y(), p4.y())));
 
-    int primitiveWidth = (*_primitives.begin())->pixmap().width();
-    int primitiveHeight = (*_primitives.begin())->pixmap().height();
+    int primitiveWidth = _primitiveSize.width();
+    int primitiveHeight = _primitiveSize.height();
 
     qreal   w = q.x() - p.x(),
             h = q.y() - p.y(),
@@ -241,20 +306,7 @@ void PuzzlePiece::verifyPosition()
 
 void PuzzlePiece::raise()
 {
-    PuzzlePiece *maxItem = this;
-    foreach (PuzzlePiece *item, static_cast<PuzzleGame*>(parent())->puzzleItems())
-        if (item->zValue() > maxItem->zValue())
-            maxItem = item;
-
-    if (maxItem == this)
-        return;
-
-    qreal max = maxItem->zValue();
-    foreach (PuzzlePiece *item, static_cast<PuzzleGame*>(parent())->puzzleItems())
-        if (item->zValue() > this->zValue())
-            item->setZValue(item->zValue() - 1);
-
-    setZValue(max);
+    static_cast<PuzzleGame*>(parent())->raisePuzzleItem(this);
 }
 
 void PuzzlePiece::addPrimitive(PuzzlePiecePrimitive *p, const QPointF &corr)
@@ -262,53 +314,101 @@ void PuzzlePiece::addPrimitive(PuzzlePiecePrimitive *p, const QPointF &corr)
     if (_primitives.contains(p))
         return;
 
-    p->setParent(this);
+    insertPrimitive(p, corr);
+    primitivesChanged();
+}
+
+// Adds the primitive to this piece and extends the bounds of the piece with it
+// NOTE: the primitive is owned by this piece from now on, but it's not a QObject child,
+//       because reparenting QObjects one by one is slow when big groups are merged
+void PuzzlePiece::insertPrimitive(PuzzlePiecePrimitive *p, const QPointF &corr)
+{
     p->setPixmapOffset(p->pixmapOffset() + corr);
     p->setStrokeOffset(p->strokeOffset() + corr);
     _primitives.insert(p);
+    _primitivesVersion++;
 
     // Find the topleft and bottomright points of this PuzzlePiece
-    // according to the PuzzlePiecePrimitive instances it contains
+    // (The bounds of the other primitives don't change, so only the new one has to be checked.)
+    QPointF topLeft = p->pixmapOffset(),
+            bottomRight = p->pixmapOffset() + QPointF(p->pixmap().width(), p->pixmap().height());
+
+    if (_primitives.count() == 1)
+    {
+        _topLeft = topLeft;
+        _bottomRight = bottomRight;
+        _primitiveSize = p->pixmap().size();
+    }
+    else
+    {
+        _topLeft = QPointF(myMin(_topLeft.x(), topLeft.x()), myMin(_topLeft.y(), topLeft.y()));
+        _bottomRight = QPointF(myMax(_bottomRight.x(), bottomRight.x()), myMax(_bottomRight.y(), bottomRight.y()));
+    }
 
-    PuzzlePiecePrimitive *ppp = *(_primitives.begin());
-    qreal x1, y1, x2, y2;
-    x1 = ppp->pixmapOffset().x();
-    y1 = ppp->pixmapOffset().y();
-    x2 = ppp->pixmapOffset().x() + ppp->pixmap().width();
-    y2 = ppp->pixmapOffset().y() + ppp->pixmap().height();
+    // The shapes which are used for hit testing may be bigger than the pixmap
+    QRectF shapeBounds = QRectF(p->hitMask().bounds) | p->usabilityBounds() | QRectF(QPointF(0, 0), p->pixmap().size());
+    _shapeBounds |= shapeBounds.translated(p->pixmapOffset());
+}
 
-    foreach (const PuzzlePiecePrimitive* pp, _primitives)
+// Replaces the primitives of this piece with a single one, which was composited by the game.
+// ----------
+// The new primitive has no stroke, because the strokes of the old ones are already in its pixmap.
+// The bounds of the pieces (without the strokes) are kept, so that the piece still
+// behaves the same way when it's moved to the edge of the board.
+// ----------
+void PuzzlePiece::setFlattened(const Puzzle::Creation::FlattenResult &result)
+{
+    PuzzleGame *game = static_cast<PuzzleGame*>(parent());
+    PuzzlePiecePrimitive *p = new PuzzlePiecePrimitive();
+    p->setPixmap(QPixmap::fromImage(result.image));
+    p->setPixmapOffset(result.offset);
+    p->setStrokeOffset(result.offset);
+    p->setHitMask(result.hitMask);
+    p->setUsabilityRects(result.usabilityRects);
+
+    // Let the renderers release the textures of the old primitives
+    foreach (PuzzlePiecePrimitive *old, _primitives)
     {
-        // Find the top-left point of this puzzle piece
-        if (pp->pixmapOffset().x() < x1)
-            x1 = pp->pixmapOffset().x();
-        if (pp->pixmapOffset().y() < y1)
-            y1 = pp->pixmapOffset().y();
-        // Find the bottom-right point of this puzzle piece
-        if (pp->pixmapOffset().x() + pp->pixmap().width() > x2)
-            x2 = pp->pixmapOffset().x() + pp->pixmap().width();
-        if (pp->pixmapOffset().x() + pp->pixmap().height() > y2)
-            y2 = pp->pixmapOffset().y() + pp->pixmap().height();
+        emit game->primitiveAboutToBeDeleted(old);
+        delete old;
     }
 
-    _topLeft = QPointF(x1, y1);
-    _bottomRight = QPointF(x2, y2);
+    QPointF topLeft = _topLeft, bottomRight = _bottomRight;
+    QSize primitiveSize = _primitiveSize;
+    _primitives.clear();
+    _shapeBounds = QRectF();
+    insertPrimitive(p, QPointF(0, 0));
+    _topLeft = topLeft;
+    _bottomRight = bottomRight;
+    _primitiveSize = primitiveSize;
+    primitivesChanged();
+}
+
+// Tells the game that the primitives (and the shape) of this piece have changed
+void PuzzlePiece::primitivesChanged()
+{
+    markMoved();
+
+    if (parent())
+        emit static_cast<PuzzleGame*>(parent())->piecePrimitivesChanged(this);
 }
 
 QPointF PuzzlePiece::mapToParent(const QPointF &p0) const
 {
-    qreal a = _rotation * M_PI / 180;
-    QPointF p = p0 - _transformOriginPoint;
+    QPointF origin = transformOriginPoint();
+    qreal a = rotation() * M_PI / 180;
+    QPointF p = p0 - origin;
     QPointF r(p.x() * cos(-a) + p.y() * sin(-a), - p.x() * sin(-a) + p.y() * cos(-a));
-    return _pos + r + _transformOriginPoint;
+    return pos() + r + origin;
 }
 
 QPointF PuzzlePiece::mapFromParent(const QPointF &p0) const
 {
-    qreal a = _rotation * M_PI / 180;
-    QPointF p = p0 - mapToParent(_transformOriginPoint);
+    QPointF origin = transformOriginPoint();
+    qreal a = rotation() * M_PI / 180;
+    QPointF p = p0 - mapToParent(origin);
     QPointF r(p.x() * cos(a) + p.y() * sin(a), - p.x() * sin(a) + p.y() * cos(a));
-    return r + _transformOriginPoint;
+    return r + origin;
 }
 
 QPointF PuzzlePiece::mapToItem(const PuzzlePiece *item, const QPointF &p) const
@@ -324,5 +424,8 @@ void PuzzlePiece::grabTouchPoint(int id)
 
 void PuzzlePiece::ungrabTouchPoint(int id)
 {
-    _grabbedTouchPointIds.removeAll(id);
+    // NOTE: the vector keeps its memory, so grabbing a touch point again doesn't allocate
+    int i = _grabbedTouchPointIds.indexOf(id);
+    if (i >= 0)
+        _grabbedTouchPointIds.remove(i);
 }
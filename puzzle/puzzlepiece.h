@@ -21,9 +21,14 @@
 
 #include <QObject>
 #include <QSet>
+#include <QVector>
+#include <QRect>
+#include <QRectF>
 
 #include "../helpers/util.h"
 #include "creation/shapeprocessor.h"
+#include "creation/groupflattener.h"
+#include "puzzlepiecestore.h"
 
 class PuzzlePiecePrimitive;
 class PuzzleGame;
@@ -31,41 +36,74 @@ class PuzzleGame;
 class PuzzlePiece : public QObject
 {
     Q_OBJECT
+    friend class PuzzleSpatialIndex;
+    friend class PuzzleGame;
+    friend class PuzzleAnimation;
     Q_PROPERTY(qreal rotation READ rotation WRITE setRotation)
     Q_PROPERTY(QPointF pos READ pos WRITE setPos)
 
     GENPROPERTY_S(QPoint, _puzzleCoordinates, puzzleCoordinates, setPuzzleCoordinates)
-    GENPROPERTY_S(QPointF, _pos, pos, setPos)
     GENPROPERTY_S(QPointF, _supposedPosition, supposedPosition, setSupposedPosition)
     GENPROPERTY_S(QPointF, _dragStart, dragStart, setDragStart)
-    GENPROPERTY_R(QPointF, _transformOriginPoint, transformOriginPoint)
-    GENPROPERTY_S(qreal, _rotation, rotation, setRotation)
-    GENPROPERTY_F(int, _zValue, zValue, setZValue, zValueChanged)
+    // The neighbours of this piece in the z order of the game (an intrusive list, from bottom to top)
+    GENPROPERTY_R(PuzzlePiece*, _pieceBelow, pieceBelow)
+    GENPROPERTY_R(PuzzlePiece*, _pieceAbove, pieceAbove)
     GENPROPERTY_S(int, _previousTouchPointCount, previousTouchPointCount, setPreviousTouchPointCount)
     GENPROPERTY_S(unsigned, _tabStatus, tabStatus, setTabStatus)
-    GENPROPERTY_R(bool, _dragging, dragging)
+    // The id of this piece in the piece store and the registry of the game
+    GENPROPERTY_R(int, _index, index)
     GENPROPERTY_S(bool, _isRightButtonPressed, isRightButtonPressed, setIsRightButtonPressed)
-    GENPROPERTY_R(bool, _isDraggingWithTouch, isDraggingWithTouch)
-    GENPROPERTY_S(bool, _isEnabled, isEnabled, setIsEnabled)
     GENPROPERTY_R(QSet<PuzzlePiece*>, _neighbours, neighbours)
     GENPROPERTY_R(QSet<PuzzlePiecePrimitive*>, _primitives, primitives)
-    GENPROPERTY_R(QList<int>, _grabbedTouchPointIds, grabbedTouchPointIds)
+    // Grows every time a primitive is added, so that the game can tell if a flattened group is still up to date
+    GENPROPERTY_R(int, _primitivesVersion, primitivesVersion)
+    GENPROPERTY_R(QVector<int>, _grabbedTouchPointIds, grabbedTouchPointIds)
 
+    // The position, rotation, transform origin, z value and flags are in the piece store
+    PuzzlePieceStore *_store;
     qreal _rotationStart;
+    // The bounds of the pixmaps of the primitives, in piece coordinates
     QPointF _topLeft, _bottomRight;
+    // The size of the pixmap of a single piece, this much of the piece is kept on the board
+    QSize _primitiveSize;
+    // The bounding rectangle of the primitives and their shapes, in piece coordinates
+    QRectF _shapeBounds;
+    // The state of this piece in the spatial index of the game
+    bool _indexed, _indexDirty;
+    QRect _indexCells;
+
+    void markMoved();
+    void insertPrimitive(PuzzlePiecePrimitive *p, const QPointF &corr);
+    void primitivesChanged();
+    void setFlag(PuzzlePieceStore::Flag flag, bool on);
 
 public:
-    explicit PuzzlePiece(PuzzleGame *parent = 0);
+    // NOTE: the piece gets its id from the game, so it must have one
+    explicit PuzzlePiece(PuzzleGame *parent);
+    ~PuzzlePiece();
+    QPointF pos() const { return QPointF(_store->x.at(_index), _store->y.at(_index)); }
+    qreal rotation() const { return _store->rotation.at(_index); }
+    QPointF transformOriginPoint() const { return QPointF(_store->originX.at(_index), _store->originY.at(_index)); }
+    // The z value is maintained by the game, it is unique and grows every time a piece is raised
+    int zValue() const { return _store->z.at(_index); }
+    bool dragging() const { return _store->flags.at(_index) & PuzzlePieceStore::Dragging; }
+    bool isDraggingWithTouch() const { return _store->flags.at(_index) & PuzzlePieceStore::DraggingWithTouch; }
+    bool isEnabled() const { return _store->flags.at(_index) & PuzzlePieceStore::Enabled; }
+    void setIsEnabled(bool enabled) { setFlag(PuzzlePieceStore::Enabled, enabled); }
     void mergeIfPossible(PuzzlePiece *item);
     void raise();
     void addNeighbour(PuzzlePiece *piece);
     void removeNeighbour(PuzzlePiece *piece);
     QPointF centerPoint() const;
     void addPrimitive(PuzzlePiecePrimitive *primitive, const QPointF &correction);
+    void setFlattened(const Puzzle::Creation::FlattenResult &result);
     QPointF mapToParent(const QPointF &p) const;
     QPointF mapFromParent(const QPointF &p) const;
     QPointF mapToItem(const PuzzlePiece *item, const QPointF &p) const;
     const QPointF &bottomRight() const { return this->_bottomRight; }
+    QRectF boundingRect() const;
+    void setPos(const QPointF &pos);
+    void setRotation(qreal rotation);
 
     void startDrag(const QPointF &pos, bool touch = false);
     void stopDrag();
@@ -74,6 +112,7 @@ public:
     void handleRotation(const QPointF &vector);
     void setTransformOriginPoint(const QPointF &point);
     void checkMergeableSiblings();
+    bool checkMergeability(PuzzlePiece *item);
 
     void grabTouchPoint(int id);
     void ungrabTouchPoint(int id);
@@ -83,15 +122,13 @@ public:
 
 signals:
     void noNeighbours();
-    void zValueChanged();
 
 protected:
     void verifyPosition();
-    bool checkMergeability(PuzzlePiece *item);
 
 protected slots:
-    void enable() { _isEnabled = true; }
-    void disable() { _isEnabled = false; }
+    void enable() { setIsEnabled(true); }
+    void disable() { setIsEnabled(false); }
 
 };
 
@@ -18,8 +18,43 @@
 
 #include "puzzlepieceprimitive.h"
 #include "puzzlepiece.h"
+#include "creation/helpertypes.h"
 
 PuzzlePiecePrimitive::PuzzlePiecePrimitive(PuzzlePiece *parent)
     : QObject(parent)
+    , _strokeKey(-1)
+    , _strokeMirror(Puzzle::Creation::ExactMatch)
 {
 }
+
+bool PuzzlePiecePrimitive::usabilityRectsContain(const QPointF &p) const
+{
+    for (int i = 0; i < _usabilityRects.count(); i++)
+        if (_usabilityRects.at(i).contains(p))
+            return true;
+
+    return false;
+}
+
+// The stroke as it looks on the board, flipped if needed
+QImage PuzzlePiecePrimitive::strokeImage() const
+{
+    QImage image = _stroke.toImage();
+
+#ifdef PUZZLEPIECEPRIMITIVE_CANONICAL_STROKES
+    if (_strokeKey >= 0 && _strokeMirror != Puzzle::Creation::ExactMatch)
+        image = image.mirrored(_strokeMirror != Puzzle::Creation::VerticalFlipMatch,
+                               _strokeMirror != Puzzle::Creation::HorizontalFlipMatch);
+#endif
+
+    return image;
+}
+
+QRectF PuzzlePiecePrimitive::usabilityBounds() const
+{
+    QRectF bounds;
+    for (int i = 0; i < _usabilityRects.count(); i++)
+        bounds |= _usabilityRects.at(i);
+
+    return bounds;
+}
@@ -22,9 +22,17 @@
 #include <QObject>
 #include <QPointF>
 #include <QPixmap>
-#include <QPainterPath>
+#include <QRectF>
+#include <QVector>
 
 #include "../helpers/util.h"
+#include "creation/maskrasterizer.h"
+
+// Since Qt 5.6 the board flips the texture coordinates of the shared strokes,
+// so the primitives get the stroke of the canonical status instead of a flipped copy
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+#define PUZZLEPIECEPRIMITIVE_CANONICAL_STROKES
+#endif
 
 class PuzzlePiece;
 
@@ -35,11 +43,22 @@ class PuzzlePiecePrimitive : public QObject
     GENPROPERTY_S(QPointF, _strokeOffset, strokeOffset, setStrokeOffset)
     GENPROPERTY_S(QPixmap, _pixmap, pixmap, setPixmap)
     GENPROPERTY_S(QPixmap, _stroke, stroke, setStroke)
-    GENPROPERTY_S(QPainterPath, _realShape, realShape, setRealShape)
-    GENPROPERTY_S(QPainterPath, _fakeShape, fakeShape, setFakeShape)
+    // The primitives with the same stroke key have the same stroke, flipped according to the mirror (a MatchMode).
+    // A negative key means that the stroke is not shared.
+    // NOTE: with canonical strokes, the pixmap of a shared stroke is not flipped yet, see strokeImage()
+    GENPROPERTY_S(int, _strokeKey, strokeKey, setStrokeKey)
+    GENPROPERTY_S(int, _strokeMirror, strokeMirror, setStrokeMirror)
+    // Where the primitive can be grabbed, relative to the pixmap offset. The hit mask is shared by the
+    // primitives with the same status, the usability rects are bigger and used when the piece is already grabbed.
+    // (A flattened group has one usability rect for each of its pieces.)
+    GENPROPERTY_S(Puzzle::Creation::HitMask, _hitMask, hitMask, setHitMask)
+    GENPROPERTY_S(QVector<QRectF>, _usabilityRects, usabilityRects, setUsabilityRects)
 
 public:
     explicit PuzzlePiecePrimitive(PuzzlePiece *parent = 0);
+    bool usabilityRectsContain(const QPointF &p) const;
+    QImage strokeImage() const;
+    QRectF usabilityBounds() const;
     
 signals:
     
@@ -0,0 +1,84 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <cmath>
+
+#include "puzzlepiecestore.h"
+
+// Adds a new piece to the store and returns its id
+int PuzzlePieceStore::add()
+{
+    x.append(0);
+    y.append(0);
+    rotation.append(0);
+    originX.append(0);
+    originY.append(0);
+    z.append(0);
+    group.append(count() - 1);
+    flags.append(Alive | Enabled);
+
+    return count() - 1;
+}
+
+void PuzzlePieceStore::clear()
+{
+    x.clear();
+    y.clear();
+    rotation.clear();
+    originX.clear();
+    originY.clear();
+    z.clear();
+    group.clear();
+    flags.clear();
+}
+
+// Finds the live piece which the given piece was merged into
+int PuzzlePieceStore::findGroup(int id)
+{
+    int *g = group.data();
+
+    // Path halving: every visited piece is pointed to its grandparent
+    while (g[id] != id)
+    {
+        g[id] = g[g[id]];
+        id = g[id];
+    }
+
+    return id;
+}
+
+// Maps the (0, 0) point of every piece to the parent's coordinate system in one pass,
+// this is where the renderers put the pieces. (Same as PuzzlePiece::mapToParent.)
+void PuzzlePieceStore::mapOriginsToParent(QVector<qreal> &resultX, QVector<qreal> &resultY) const
+{
+    int n = count();
+    resultX.resize(n);
+    resultY.resize(n);
+
+    const qreal *px = x.constData(), *py = y.constData(), *pr = rotation.constData(),
+                *pox = originX.constData(), *poy = originY.constData();
+    qreal *rx = resultX.data(), *ry = resultY.data();
+
+    for (int i = 0; i < n; i++)
+    {
+        qreal a = pr[i] * M_PI / 180;
+        qreal c = cos(-a), s = sin(-a);
+        rx[i] = px[i] - pox[i] * c - poy[i] * s + pox[i];
+        ry[i] = py[i] + pox[i] * s - poy[i] * c + poy[i];
+    }
+}
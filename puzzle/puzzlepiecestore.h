@@ -0,0 +1,55 @@
+
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef PUZZLEPIECESTORE_H
+#define PUZZLEPIECESTORE_H
+
+#include <QVector>
+
+// The frequently used state of the pieces, in flat arrays (structure of arrays).
+// ----------
+// Every piece gets a stable id when it's created, which is its index in the arrays.
+// The PuzzlePiece objects keep their position, rotation, transform origin, z value,
+// group and flags here, so the passes that go through every piece only read
+// contiguous memory instead of chasing pointers, and the compiler can vectorize them.
+// The groups of the merged pieces are a union-find forest: the group of a piece is
+// the id of its parent in the forest, and the roots are the pieces which are alive.
+// NOTE: the ids are only reused after clear(), ie. when a new game starts
+// ----------
+struct PuzzlePieceStore
+{
+    enum Flag
+    {
+        Alive = 0x1,
+        Enabled = 0x2,
+        Dragging = 0x4,
+        DraggingWithTouch = 0x8
+    };
+
+    QVector<qreal> x, y, rotation, originX, originY;
+    QVector<int> z, group;
+    QVector<quint8> flags;
+
+    int add();
+    void clear();
+    int count() const { return x.count(); }
+    int findGroup(int id);
+    void mapOriginsToParent(QVector<qreal> &resultX, QVector<qreal> &resultY) const;
+};
+
+#endif // PUZZLEPIECESTORE_H
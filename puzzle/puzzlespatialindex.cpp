@@ -0,0 +1,145 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#include <cmath>
+#include <algorithm>
+
+#include "puzzlespatialindex.h"
+#include "puzzlepiece.h"
+#include "../helpers/util.h"
+
+// How many moved pieces fit into the dirty list without allocating
+#define PUZZLESPATIALINDEX_RESERVED_DIRTY 64
+
+PuzzleSpatialIndex::PuzzleSpatialIndex()
+{
+    reset(QSizeF(), 1);
+}
+
+void PuzzleSpatialIndex::reset(const QSizeF &size, qreal cellSize)
+{
+    _cellSize = myMax<qreal>(1, cellSize);
+    _cols = MAX(1, (int) ceil(size.width() / _cellSize));
+    _rows = MAX(1, (int) ceil(size.height() / _cellSize));
+    _cells.clear();
+    _cells.resize(_cols * _rows);
+    _dirty.clear();
+
+    // NOTE: a reserved vector keeps its memory when it's resized to 0
+    _dirty.reserve(PUZZLESPATIALINDEX_RESERVED_DIRTY);
+}
+
+QRect PuzzleSpatialIndex::cellRange(const QRectF &rect) const
+{
+    int x1 = CLAMP((int) floor(rect.left() / _cellSize), 0, _cols - 1),
+        y1 = CLAMP((int) floor(rect.top() / _cellSize), 0, _rows - 1),
+        x2 = CLAMP((int) floor(rect.right() / _cellSize), 0, _cols - 1),
+        y2 = CLAMP((int) floor(rect.bottom() / _cellSize), 0, _rows - 1);
+
+    return QRect(QPoint(x1, y1), QPoint(x2, y2));
+}
+
+void PuzzleSpatialIndex::addToCells(PuzzlePiece *piece, const QRect &cells)
+{
+    for (int y = cells.top(); y <= cells.bottom(); y++)
+        for (int x = cells.left(); x <= cells.right(); x++)
+            _cells[y * _cols + x].append(piece);
+}
+
+void PuzzleSpatialIndex::removeFromCells(PuzzlePiece *piece, const QRect &cells)
+{
+    for (int y = cells.top(); y <= cells.bottom(); y++)
+    {
+        for (int x = cells.left(); x <= cells.right(); x++)
+        {
+            // The order within a cell doesn't matter, so the last one can take its place
+            QVector<PuzzlePiece*> &cell = _cells[y * _cols + x];
+            int i = cell.indexOf(piece);
+
+            if (i >= 0)
+            {
+                cell[i] = cell.last();
+                cell.remove(cell.size() - 1);
+            }
+        }
+    }
+}
+
+void PuzzleSpatialIndex::insert(PuzzlePiece *piece)
+{
+    if (piece->_indexed)
+        return;
+
+    piece->_indexed = true;
+    piece->_indexCells = cellRange(piece->boundingRect());
+    piece->_indexDirty = false;
+    addToCells(piece, piece->_indexCells);
+}
+
+void PuzzleSpatialIndex::remove(PuzzlePiece *piece)
+{
+    if (!piece->_indexed)
+        return;
+
+    if (piece->_indexDirty)
+        _dirty.remove(_dirty.indexOf(piece));
+
+    removeFromCells(piece, piece->_indexCells);
+    piece->_indexed = piece->_indexDirty = false;
+}
+
+void PuzzleSpatialIndex::markDirty(PuzzlePiece *piece)
+{
+    if (!piece->_indexed || piece->_indexDirty)
+        return;
+
+    piece->_indexDirty = true;
+    _dirty.append(piece);
+}
+
+void PuzzleSpatialIndex::flush()
+{
+    for (int i = 0; i < _dirty.count(); i++)
+    {
+        PuzzlePiece *piece = _dirty[i];
+        QRect cells = cellRange(piece->boundingRect());
+        piece->_indexDirty = false;
+
+        if (cells == piece->_indexCells)
+            continue;
+
+        removeFromCells(piece, piece->_indexCells);
+        addToCells(piece, cells);
+        piece->_indexCells = cells;
+    }
+
+    _dirty.resize(0);
+}
+
+void PuzzleSpatialIndex::candidatesAt(const QPointF &p, QVector<PuzzlePiece*> &result)
+{
+    flush();
+
+    int x = CLAMP((int) floor(p.x() / _cellSize), 0, _cols - 1),
+        y = CLAMP((int) floor(p.y() / _cellSize), 0, _rows - 1);
+
+    // Copy the cell instead of sharing it, so that sorting doesn't allocate a new buffer
+    const QVector<PuzzlePiece*> &cell = _cells[y * _cols + x];
+    result.resize(cell.count());
+    std::copy(cell.constBegin(), cell.constEnd(), result.begin());
+    std::sort(result.begin(), result.end(), PuzzlePiece::puzzleItemDescLessThan);
+}
@@ -0,0 +1,61 @@
+// This file is part of Puzzle Master, a fun and addictive jigsaw puzzle game.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+// Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
+
+#ifndef PUZZLESPATIALINDEX_H
+#define PUZZLESPATIALINDEX_H
+
+#include <QVector>
+#include <QPointF>
+#include <QSizeF>
+#include <QRect>
+
+class PuzzlePiece;
+
+// Finds the pieces which may be under a point, without looking at every piece.
+// ----------
+// The board is divided into a uniform grid, and every cell knows the pieces
+// whose rotated bounding rectangle overlaps it. The pieces outside the board
+// are in the cells at its edges.
+// When a piece moves, it is only marked dirty, and the dirty pieces are moved
+// to their new cells before the next query, so moving pieces around costs
+// nothing until something is hit tested.
+// ----------
+class PuzzleSpatialIndex
+{
+    QVector<QVector<PuzzlePiece*> > _cells;
+    QVector<PuzzlePiece*> _dirty;
+    int _cols, _rows;
+    qreal _cellSize;
+
+    QRect cellRange(const QRectF &rect) const;
+    void addToCells(PuzzlePiece *piece, const QRect &cells);
+    void removeFromCells(PuzzlePiece *piece, const QRect &cells);
+    void flush();
+
+public:
+    PuzzleSpatialIndex();
+    // NOTE: this forgets all the pieces without touching them, so they may be already deleted
+    void reset(const QSizeF &size, qreal cellSize);
+    void insert(PuzzlePiece *piece);
+    void remove(PuzzlePiece *piece);
+    void markDirty(PuzzlePiece *piece);
+    // The pieces whose bounding rectangle may contain the point, topmost first
+    // NOTE: the result is overwritten, so a vector which is reused doesn't allocate after the first few calls
+    void candidatesAt(const QPointF &p, QVector<PuzzlePiece*> &result);
+};
+
+#endif // PUZZLESPATIALINDEX_H
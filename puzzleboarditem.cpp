@@ -21,61 +21,53 @@
 #include <QSGSimpleTextureNode>
 #include <QSGTransformNode>
 #include <QSGTexture>
-#include <QTimer>
+#include <QSGGeometryNode>
+#include <QSGTextureMaterial>
+#include <QPainter>
+#include <cstring>
 
 #include "puzzleboarditem.h"
 #include "puzzle/puzzlepiece.h"
 #include "puzzle/puzzlepieceprimitive.h"
+#include "puzzle/creation/helpertypes.h"
+
+// The size of the atlas textures and the free space between the images in them
+#define PUZZLEBOARDITEM_ATLAS_SIZE 2048
+#define PUZZLEBOARDITEM_ATLAS_PADDING 1
+// The queues a piece can be in until the next update, see queueChange()
+#define PUZZLEBOARDITEM_TRANSFORMATION_CHANGED 0x1
+#define PUZZLEBOARDITEM_PRIMITIVES_CHANGED 0x2
+#define PUZZLEBOARDITEM_RAISED 0x4
 
 PuzzleBoardItem::PuzzleBoardItem(QQuickItem *parent)
     : QQuickItem(parent)
 {
     _game = new PuzzleGame(this);
-    _autoUpdater = new QTimer(this);
     _clearNodes = false;
-    _previousPuzzlePieces = 0;
-    _autoUpdateRequests = 0;
+    _batched = qgetenv("PUZZLE_MASTER_BATCHED_RENDERING") == "1";
 
     connect(this, SIGNAL(widthChanged()), this, SLOT(updateGame()));
     connect(this, SIGNAL(heightChanged()), this, SLOT(updateGame()));
     connect(this, SIGNAL(visibleChanged()), this, SLOT(clearNodes()));
-    connect(this, SIGNAL(newGameStarting()), this, SLOT(clearNodes()));
+    connect(_game, SIGNAL(newGameStarting()), this, SLOT(clearNodes()));
     connect(_game, SIGNAL(gameStarted()), this, SLOT(update()));
-    connect(_game, SIGNAL(loaded()), this, SLOT(onGameLoaded()));
+    connect(_game, SIGNAL(pieceAdded(PuzzlePiece*)), this, SLOT(onPieceAdded(PuzzlePiece*)));
+    connect(_game, SIGNAL(pieceRemoved(PuzzlePiece*)), this, SLOT(onPieceRemoved(PuzzlePiece*)));
+    connect(_game, SIGNAL(pieceRaised(PuzzlePiece*)), this, SLOT(onPieceRaised(PuzzlePiece*)));
+    connect(_game, SIGNAL(pieceTransformationChanged(PuzzlePiece*)), this, SLOT(onPieceTransformationChanged(PuzzlePiece*)));
+    connect(_game, SIGNAL(piecePrimitivesChanged(PuzzlePiece*)), this, SLOT(onPiecePrimitivesChanged(PuzzlePiece*)));
+    connect(_game, SIGNAL(primitiveAboutToBeDeleted(PuzzlePiecePrimitive*)), this, SLOT(onPrimitiveAboutToBeDeleted(PuzzlePiecePrimitive*)));
     connect(_game, SIGNAL(loadProgressChanged(int)), this, SLOT(update()));
-    connect(_game, SIGNAL(animationStarting()), this, SLOT(enableAutoUpdate()));
-    connect(_game, SIGNAL(animationStopped()), this, SLOT(disableAutoUpdate()));
-    connect(_autoUpdater, SIGNAL(timeout()), this, SLOT(update()));
 
     setAcceptedMouseButtons(Qt::LeftButton | Qt::RightButton);
     setFlag(QQuickItem::ItemHasContents, true);
-
-    _autoUpdater->setInterval(20);
 }
 
 PuzzleBoardItem::~PuzzleBoardItem()
 {
     qDeleteAll(_textures);
     _textures.clear();
-}
-
-void PuzzleBoardItem::enableAutoUpdate()
-{
-    _autoUpdateRequests++;
-
-    if (!_autoUpdater->isActive())
-        _autoUpdater->start();
-}
-
-void PuzzleBoardItem::disableAutoUpdate()
-{
-    _autoUpdateRequests--;
-
-    if (_autoUpdateRequests == 0 && _autoUpdater->isActive())
-    {
-        _autoUpdater->stop();
-        update();
-    }
+    clearAtlas();
 }
 
 void PuzzleBoardItem::updateGame()
@@ -88,8 +80,6 @@ void PuzzleBoardItem::mousePressEvent(QMouseEvent *event)
 {
     event->accept();
     _game->handleMousePress(event->button(), event->pos());
-    if (!_autoUpdater->isActive())
-        update();
 }
 
 void PuzzleBoardItem::mouseReleaseEvent(QMouseEvent *event)
@@ -102,30 +92,32 @@ void PuzzleBoardItem::mouseMoveEvent(QMouseEvent *event)
 {
     event->accept();
     _game->handleMouseMove(event->pos());
-    if (!_autoUpdater->isActive())
-        update();
 }
 
 void PuzzleBoardItem::touchEvent(QTouchEvent *event)
 {
     event->accept();
     _game->handleTouchEvent(event);
-    if (!_autoUpdater->isActive())
-        update();
 }
 
-void PuzzleBoardItem::onGameLoaded()
+void PuzzleBoardItem::onPieceRaised(PuzzlePiece *piece)
 {
-    foreach (PuzzlePiece *piece, _game->puzzleItems())
-    {
-        connect(piece, SIGNAL(zValueChanged()), this, SLOT(onZOrderChanged()));
-    }
+    // This will make the updatePaintNode() method move the node of this piece to the top
+    // NOTE: a piece raised twice is moved twice, so that the order of raising is kept
+    _raisedPieces.append(piece);
+    queueChange(piece, PUZZLEBOARDITEM_RAISED);
+    update();
 }
 
-void PuzzleBoardItem::onZOrderChanged()
+void PuzzleBoardItem::setBatched(bool batched)
 {
-    // This will make the updatePaintNode() method rearrange the pieces
-    _zOrderChanged = true;
+    if (_batched == batched)
+        return;
+
+    // The nodes of the other mode are not needed anymore
+    _batched = batched;
+    emit batchedChanged();
+    clearNodes();
 }
 
 void PuzzleBoardItem::clearNodes()
@@ -135,6 +127,558 @@ void PuzzleBoardItem::clearNodes()
     update();
 }
 
+// Finds the part of the image which isn't fully transparent
+static QRect opaqueBounds(const QImage &image0)
+{
+    QImage image = image0.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    int x1 = image.width(), y1 = image.height(), x2 = -1, y2 = -1;
+
+    for (int y = 0; y < image.height(); y++)
+    {
+        const QRgb *line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); x++)
+        {
+            if (qAlpha(line[x]))
+            {
+                x1 = MIN(x1, x);
+                x2 = MAX(x2, x);
+                y1 = MIN(y1, y);
+                y2 = MAX(y2, y);
+            }
+        }
+    }
+
+    if (x2 < 0)
+        return QRect(0, 0, 1, 1) & image.rect();
+
+    return QRect(QPoint(x1, y1), QPoint(x2, y2));
+}
+
+// Trims the image to its opaque part and packs it into a page of the atlas.
+// ----------
+// The pages are only uploaded at the end of updatePaintNode(), so when many images are
+// added in the same frame, every page is uploaded only once. The images that don't fit
+// into a page (or every image, before Qt 5.5) get their own texture instead.
+// ----------
+PuzzleBoardItem::AtlasEntry PuzzleBoardItem::addToAtlas(const QImage &image)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    AtlasEntry entry;
+    entry.trimmedRect = opaqueBounds(image);
+    entry.page = -1;
+    entry.texture = 0;
+
+    QPoint pos;
+    for (int i = 0; i < _atlasPages.count() && entry.page < 0; i++)
+        if (_atlasPages[i]->packer.insert(entry.trimmedRect.size(), &pos))
+            entry.page = i;
+
+    // NOTE: the packer leaves the padding free next to every image, so it has to fit too
+    if (entry.page < 0 &&
+            entry.trimmedRect.width() <= PUZZLEBOARDITEM_ATLAS_SIZE - PUZZLEBOARDITEM_ATLAS_PADDING &&
+            entry.trimmedRect.height() <= PUZZLEBOARDITEM_ATLAS_SIZE - PUZZLEBOARDITEM_ATLAS_PADDING)
+    {
+        AtlasPage *page = new AtlasPage();
+        page->packer = RectPacker(QSize(PUZZLEBOARDITEM_ATLAS_SIZE, PUZZLEBOARDITEM_ATLAS_SIZE), PUZZLEBOARDITEM_ATLAS_PADDING);
+        page->texture = 0;
+        page->dirty = false;
+        page->users = 0;
+
+        if (page->packer.insert(entry.trimmedRect.size(), &pos))
+        {
+            page->image = QImage(PUZZLEBOARDITEM_ATLAS_SIZE, PUZZLEBOARDITEM_ATLAS_SIZE, QImage::Format_ARGB32_Premultiplied);
+            page->image.fill(Qt::transparent);
+            _atlasPages.append(page);
+            entry.page = _atlasPages.count() - 1;
+        }
+        else
+        {
+            // The image gets its own texture below
+            delete page;
+        }
+    }
+
+    if (entry.page >= 0)
+    {
+        AtlasPage *page = _atlasPages[entry.page];
+        if (page->image.isNull())
+        {
+            // This page was emptied, see releaseEntry()
+            page->image = QImage(PUZZLEBOARDITEM_ATLAS_SIZE, PUZZLEBOARDITEM_ATLAS_SIZE, QImage::Format_ARGB32_Premultiplied);
+            page->image.fill(Qt::transparent);
+        }
+
+        QPainter painter(&page->image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(pos, image, entry.trimmedRect);
+        page->dirty = true;
+        entry.sourceRect = QRect(pos, entry.trimmedRect.size());
+        return entry;
+    }
+#endif
+
+    return addOwnTexture(image);
+}
+
+// Trims the image to its opaque part and uploads it as a texture of its own.
+// ----------
+// The flattened groups use this instead of the atlas: every merge flattens the group again,
+// and if its image was on a page, the whole page would have to be uploaded again each time.
+// ----------
+PuzzleBoardItem::AtlasEntry PuzzleBoardItem::addOwnTexture(const QImage &image)
+{
+    AtlasEntry entry;
+    entry.trimmedRect = opaqueBounds(image);
+    entry.page = -1;
+    entry.texture = this->window()->createTextureFromImage(image.copy(entry.trimmedRect));
+    entry.sourceRect = QRect(QPoint(0, 0), entry.trimmedRect.size());
+    _textures.append(entry.texture);
+    return entry;
+}
+
+void PuzzleBoardItem::setNodeTexture(QSGSimpleTextureNode *node, const AtlasEntry &entry)
+{
+    if (entry.page < 0)
+    {
+        node->setTexture(entry.texture);
+        return;
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    // If the page is not uploaded yet, uploadAtlas() will set the texture
+    AtlasPage *page = _atlasPages[entry.page];
+    page->nodes.append(node);
+    if (page->texture)
+        node->setTexture(page->texture);
+    node->setSourceRect(entry.sourceRect);
+#endif
+}
+
+// Uploads the pages of the atlas which have changed and gives the new textures to their nodes,
+// returns true if any of them was uploaded
+bool PuzzleBoardItem::uploadAtlas()
+{
+    bool uploaded = false;
+
+    foreach (AtlasPage *page, _atlasPages)
+    {
+        if (!page->dirty)
+            continue;
+
+        QSGTexture *oldTexture = page->texture;
+        page->texture = this->window()->createTextureFromImage(page->image);
+        page->dirty = false;
+
+        foreach (QSGSimpleTextureNode *node, page->nodes)
+            node->setTexture(page->texture);
+
+        delete oldTexture;
+        uploaded = true;
+    }
+
+    return uploaded;
+}
+
+void PuzzleBoardItem::clearAtlas()
+{
+    foreach (AtlasPage *page, _atlasPages)
+        delete page->texture;
+
+    qDeleteAll(_atlasPages);
+    _atlasPages.clear();
+}
+
+// The pieces which have the same stroke share the same part of the atlas.
+// Since Qt 5.6, even the flipped strokes share it: the primitives have the canonical stroke,
+// and the texture coordinates are flipped instead.
+PuzzleBoardItem::AtlasEntry PuzzleBoardItem::strokeEntry(const PuzzlePiecePrimitive *pr)
+{
+    if (pr->strokeKey() < 0)
+    {
+        // This stroke is not shared
+        return addToAtlas(pr->stroke().toImage());
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    int key = pr->strokeKey();
+#else
+    int key = (pr->strokeKey() << 3) | pr->strokeMirror();
+#endif
+
+    if (!_strokeEntries.contains(key))
+        _strokeEntries.insert(key, addToAtlas(pr->stroke().toImage()));
+
+    return _strokeEntries.value(key);
+}
+
+// NOTE: in the batched mode only the atlas entries are created, the nodes are not
+PuzzleBoardItem::PrimitiveNodes PuzzleBoardItem::createPrimitiveNodes(const PuzzlePiecePrimitive *pr)
+{
+    PrimitiveNodes nodes;
+    nodes.stroke = nodes.piece = 0;
+    nodes.strokeMirroredHorizontally = nodes.strokeMirroredVertically = false;
+    nodes.strokeShared = pr->strokeKey() >= 0;
+    nodes.strokeEntry.page = -1;
+    nodes.strokeEntry.texture = 0;
+
+    // NOTE: the flattened groups have no stroke, it's in their pixmap
+    if (!pr->stroke().isNull())
+    {
+        nodes.strokeEntry = strokeEntry(pr);
+        nodes.strokeRect = nodes.strokeEntry.trimmedRect;
+        retainEntry(nodes.strokeEntry);
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    if (nodes.strokeShared && !pr->stroke().isNull())
+    {
+        if (pr->strokeMirror() == Puzzle::Creation::HorizontalFlipMatch || pr->strokeMirror() == Puzzle::Creation::HorizontalAndVerticalFlipMatch)
+        {
+            nodes.strokeMirroredHorizontally = true;
+            nodes.strokeRect.moveLeft(pr->stroke().width() - nodes.strokeRect.x() - nodes.strokeRect.width());
+        }
+        if (pr->strokeMirror() == Puzzle::Creation::VerticalFlipMatch || pr->strokeMirror() == Puzzle::Creation::HorizontalAndVerticalFlipMatch)
+        {
+            nodes.strokeMirroredVertically = true;
+            nodes.strokeRect.moveTop(pr->stroke().height() - nodes.strokeRect.y() - nodes.strokeRect.height());
+        }
+    }
+#endif
+
+    if (pr->stroke().isNull())
+        nodes.pieceEntry = addOwnTexture(pr->pixmap().toImage());
+    else
+        nodes.pieceEntry = addToAtlas(pr->pixmap().toImage());
+    nodes.pieceRect = nodes.pieceEntry.trimmedRect;
+    retainEntry(nodes.pieceEntry);
+
+    if (!_batched && !pr->stroke().isNull())
+    {
+        nodes.stroke = new QSGSimpleTextureNode();
+        setNodeTexture(nodes.stroke, nodes.strokeEntry);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+        QSGSimpleTextureNode::TextureCoordinatesTransformMode mode = QSGSimpleTextureNode::NoTransform;
+        if (nodes.strokeMirroredHorizontally)
+            mode |= QSGSimpleTextureNode::MirrorHorizontally;
+        if (nodes.strokeMirroredVertically)
+            mode |= QSGSimpleTextureNode::MirrorVertically;
+        nodes.stroke->setTextureCoordinatesTransform(mode);
+#endif
+        nodes.stroke->setFlag(QSGNode::OwnedByParent);
+    }
+
+    if (!_batched)
+    {
+        nodes.piece = new QSGSimpleTextureNode();
+        setNodeTexture(nodes.piece, nodes.pieceEntry);
+        nodes.piece->setFlag(QSGNode::OwnedByParent);
+    }
+
+    _primitiveNodes.insert(pr, nodes);
+    return nodes;
+}
+
+void PuzzleBoardItem::retainEntry(const AtlasEntry &entry)
+{
+    if (entry.page >= 0)
+        _atlasPages[entry.page]->users++;
+}
+
+// Gives back an image of a primitive which was deleted.
+// ----------
+// The atlas pages are not defragmented, but when every image of a page is released
+// (eg. all the pieces on it were flattened into groups), its texture is deleted and
+// the whole page is reused. The images which have their own texture are deleted
+// right away, except for the shared strokes, which are kept as long as the atlas.
+// ----------
+void PuzzleBoardItem::releaseEntry(const AtlasEntry &entry, QSGSimpleTextureNode *node, bool shared)
+{
+    if (entry.page < 0)
+    {
+        if (entry.texture && !shared)
+        {
+            _textures.removeOne(entry.texture);
+            delete entry.texture;
+        }
+        return;
+    }
+
+    AtlasPage *page = _atlasPages[entry.page];
+    if (node)
+        page->nodes.removeOne(node);
+
+    if (--page->users > 0)
+        return;
+
+    delete page->texture;
+    page->texture = 0;
+    page->image = QImage();
+    page->packer.clear();
+    page->nodes.clear();
+    page->dirty = false;
+
+    // The shared strokes on this page are gone too
+    QMutableHashIterator<int, AtlasEntry> i(_strokeEntries);
+    while (i.hasNext())
+        if (i.next().value().page == entry.page)
+            i.remove();
+}
+
+// Deletes the nodes of the deleted primitives and releases their images
+void PuzzleBoardItem::releasePrimitives()
+{
+    foreach (const PuzzlePiecePrimitive *pr, _deletedPrimitives)
+    {
+        if (!_primitiveNodes.contains(pr))
+            continue;
+
+        // NOTE: in the batched mode there are no nodes, and the flattened groups have no stroke
+        PrimitiveNodes nodes = _primitiveNodes.take(pr);
+        if (nodes.stroke && nodes.stroke->parent())
+            nodes.stroke->parent()->removeChildNode(nodes.stroke);
+        if (nodes.piece && nodes.piece->parent())
+            nodes.piece->parent()->removeChildNode(nodes.piece);
+
+        releaseEntry(nodes.strokeEntry, nodes.stroke, nodes.strokeShared);
+        releaseEntry(nodes.pieceEntry, nodes.piece, false);
+        delete nodes.stroke;
+        delete nodes.piece;
+    }
+    _deletedPrimitives.clear();
+}
+
+// Returns the texture of an atlas entry and the part of it which contains the image
+QSGTexture *PuzzleBoardItem::entryTexture(const AtlasEntry &entry, QRectF *textureRect) const
+{
+    if (entry.page < 0)
+    {
+        *textureRect = entry.texture->normalizedTextureSubRect();
+        return entry.texture;
+    }
+
+    *textureRect = QRectF((qreal) entry.sourceRect.x() / PUZZLEBOARDITEM_ATLAS_SIZE,
+                          (qreal) entry.sourceRect.y() / PUZZLEBOARDITEM_ATLAS_SIZE,
+                          (qreal) entry.sourceRect.width() / PUZZLEBOARDITEM_ATLAS_SIZE,
+                          (qreal) entry.sourceRect.height() / PUZZLEBOARDITEM_ATLAS_SIZE);
+    return _atlasPages[entry.page]->texture;
+}
+
+// Appends the two triangles of a quad to the batch, starts a new draw call when the texture changes
+void PuzzleBoardItem::appendQuad(QList<BatchRun> &runs, const QTransform &transform, const QRectF &rect, const AtlasEntry &entry, bool mirrorHorizontally, bool mirrorVertically) const
+{
+    QRectF t;
+    QSGTexture *texture = entryTexture(entry, &t);
+
+    if (runs.isEmpty() || runs.last().texture != texture)
+    {
+        BatchRun run;
+        run.texture = texture;
+        runs.append(run);
+    }
+
+    qreal u1 = t.left(), u2 = t.right(), v1 = t.top(), v2 = t.bottom();
+    if (mirrorHorizontally)
+        qSwap(u1, u2);
+    if (mirrorVertically)
+        qSwap(v1, v2);
+
+    QPointF p1 = transform.map(rect.topLeft()),
+            p2 = transform.map(rect.topRight()),
+            p3 = transform.map(rect.bottomLeft()),
+            p4 = transform.map(rect.bottomRight());
+
+    QVector<QSGGeometry::TexturedPoint2D> &vertices = runs.last().vertices;
+    int i = vertices.count();
+    vertices.resize(i + 6);
+    vertices[i + 0].set(p1.x(), p1.y(), u1, v1);
+    vertices[i + 1].set(p2.x(), p2.y(), u2, v1);
+    vertices[i + 2].set(p3.x(), p3.y(), u1, v2);
+    vertices[i + 3].set(p3.x(), p3.y(), u1, v2);
+    vertices[i + 4].set(p2.x(), p2.y(), u2, v1);
+    vertices[i + 5].set(p4.x(), p4.y(), u2, v2);
+}
+
+// Draws the whole board with as few geometry nodes as possible.
+// ----------
+// The quads of the pieces are put into the vertex buffers from bottom to top, so the
+// z order is given by the order of the vertices. A new geometry node (and draw call)
+// is only needed when the texture changes, ie. when the next image is on another page.
+// Unlike the nodes of the normal mode, the vertices are recalculated whenever anything
+// changes, but that is still cheaper than hundreds of draw calls on big boards.
+// ----------
+void PuzzleBoardItem::updateBatch(QSGNode *mainNode)
+{
+    bool changed = !_addedPieces.isEmpty() || !_removedPieces.isEmpty() || !_raisedPieces.isEmpty() ||
+                   !_changedTransformations.isEmpty() || !_changedPrimitives.isEmpty();
+
+    // Pack the images of the new primitives
+    foreach (PuzzlePiece *piece, _changedPrimitives)
+        foreach (const PuzzlePiecePrimitive *pr, piece->primitives())
+            if (!_primitiveNodes.contains(pr))
+                createPrimitiveNodes(pr);
+
+    _addedPieces.clear();
+    _removedPieces.clear();
+    clearChanges();
+
+    // NOTE: the textures of the uploaded pages are new, so the materials have to be updated too
+    if (!uploadAtlas() && !changed)
+        return;
+
+    // Calculate where every piece is in one pass over the piece store
+    const PuzzlePieceStore &store = _game->pieceStore();
+    store.mapOriginsToParent(_batchOriginsX, _batchOriginsY);
+
+    QList<BatchRun> runs;
+    for (PuzzlePiece *piece = _game->bottomPiece(); piece; piece = piece->pieceAbove())
+    {
+        int id = piece->index();
+        QTransform transform = QTransform::fromTranslate(_batchOriginsX[id], _batchOriginsY[id]).rotate(store.rotation[id]);
+
+        foreach (const PuzzlePiecePrimitive *pr, piece->primitives())
+        {
+            if (pr->stroke().isNull())
+                continue;
+
+            const PrimitiveNodes &nodes = _primitiveNodes[pr];
+            appendQuad(runs, transform, QRectF(nodes.strokeRect).translated(pr->strokeOffset()), nodes.strokeEntry,
+                       nodes.strokeMirroredHorizontally, nodes.strokeMirroredVertically);
+        }
+
+        foreach (const PuzzlePiecePrimitive *pr, piece->primitives())
+        {
+            const PrimitiveNodes &nodes = _primitiveNodes[pr];
+            appendQuad(runs, transform, QRectF(nodes.pieceRect).translated(pr->pixmapOffset()), nodes.pieceEntry, false, false);
+        }
+    }
+
+    // Reuse the existing geometry nodes and delete the ones which are not needed anymore
+    while (_batchNodes.count() > runs.count())
+    {
+        QSGGeometryNode *node = _batchNodes.takeLast();
+        mainNode->removeChildNode(node);
+        delete node;
+    }
+
+    for (int i = 0; i < runs.count(); i++)
+    {
+        if (i == _batchNodes.count())
+        {
+            QSGGeometryNode *node = new QSGGeometryNode();
+            QSGGeometry *geometry = new QSGGeometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 0);
+            geometry->setDrawingMode(GL_TRIANGLES);
+            node->setGeometry(geometry);
+            node->setMaterial(new QSGTextureMaterial());
+            node->setFlags(QSGNode::OwnedByParent | QSGNode::OwnsGeometry | QSGNode::OwnsMaterial);
+            mainNode->appendChildNode(node);
+            _batchNodes.append(node);
+        }
+
+        QSGGeometryNode *node = _batchNodes[i];
+        const QVector<QSGGeometry::TexturedPoint2D> &vertices = runs[i].vertices;
+        node->geometry()->allocate(vertices.count());
+        memcpy(node->geometry()->vertexDataAsTexturedPoint2D(), vertices.constData(), vertices.count() * sizeof(QSGGeometry::TexturedPoint2D));
+        static_cast<QSGTextureMaterial*>(node->material())->setTexture(runs[i].texture);
+        node->markDirty(QSGNode::DirtyGeometry | QSGNode::DirtyMaterial);
+    }
+}
+
+// The board is only rendered when something has changed.
+// ----------
+// Every change of the pieces schedules an update, and QQuickItem::update() schedules at
+// most one frame, which the window renders in sync with the display. The animations of
+// the game are advanced by the animation driver of the window before every frame, so they
+// are as smooth as the refresh rate allows, and nothing is rendered when the board is idle.
+// ----------
+void PuzzleBoardItem::onPieceAdded(PuzzlePiece *piece)
+{
+    _addedPieces.append(piece);
+    queueChange(piece, PUZZLEBOARDITEM_TRANSFORMATION_CHANGED | PUZZLEBOARDITEM_PRIMITIVES_CHANGED);
+    update();
+}
+
+static void removeFromQueue(QVector<PuzzlePiece*> &queue, PuzzlePiece *piece)
+{
+    int i;
+    while ((i = queue.indexOf(piece)) >= 0)
+        queue.remove(i);
+}
+
+void PuzzleBoardItem::onPieceRemoved(PuzzlePiece *piece)
+{
+    // NOTE: the piece may be deleted by the time of the next update, so it is only used as a key from now on
+    _removedPieces.append(piece);
+
+    int id = piece->index();
+    if (id < _pieceChanges.count() && _pieceChanges[id])
+    {
+        removeFromQueue(_raisedPieces, piece);
+        removeFromQueue(_changedTransformations, piece);
+        removeFromQueue(_changedPrimitives, piece);
+        _pieceChanges[id] = 0;
+    }
+    update();
+}
+
+void PuzzleBoardItem::onPieceTransformationChanged(PuzzlePiece *piece)
+{
+    queueChange(piece, PUZZLEBOARDITEM_TRANSFORMATION_CHANGED);
+    update();
+}
+
+void PuzzleBoardItem::onPiecePrimitivesChanged(PuzzlePiece *piece)
+{
+    queueChange(piece, PUZZLEBOARDITEM_PRIMITIVES_CHANGED);
+    update();
+}
+
+// Puts the piece into the queues of the given changes, unless it's already there.
+// ----------
+// A piece is moved many times between two updates while it's dragged, so the flags of the
+// pieces tell which queues they are in. The queues are vectors which keep their memory
+// when they are emptied, so once they have grown, queueing a change doesn't allocate.
+// ----------
+void PuzzleBoardItem::queueChange(PuzzlePiece *piece, int change)
+{
+    int id = piece->index();
+    if (id >= _pieceChanges.count())
+        _pieceChanges.resize(id + 1);
+
+    int queued = _pieceChanges[id];
+    _pieceChanges[id] = queued | change;
+
+    if ((change & PUZZLEBOARDITEM_TRANSFORMATION_CHANGED) && !(queued & PUZZLEBOARDITEM_TRANSFORMATION_CHANGED))
+        _changedTransformations.append(piece);
+    if ((change & PUZZLEBOARDITEM_PRIMITIVES_CHANGED) && !(queued & PUZZLEBOARDITEM_PRIMITIVES_CHANGED))
+        _changedPrimitives.append(piece);
+}
+
+// Empties the queues of the changes after an update
+void PuzzleBoardItem::clearChanges()
+{
+    foreach (PuzzlePiece *piece, _raisedPieces)
+        _pieceChanges[piece->index()] = 0;
+    foreach (PuzzlePiece *piece, _changedTransformations)
+        _pieceChanges[piece->index()] = 0;
+    foreach (PuzzlePiece *piece, _changedPrimitives)
+        _pieceChanges[piece->index()] = 0;
+
+    // NOTE: resizing to zero keeps the memory of the vectors
+    _raisedPieces.resize(0);
+    _changedTransformations.resize(0);
+    _changedPrimitives.resize(0);
+}
+
+void PuzzleBoardItem::onPrimitiveAboutToBeDeleted(PuzzlePiecePrimitive *primitive)
+{
+    _deletedPrimitives.append(primitive);
+    update();
+}
+
+// Updates only the nodes of the pieces which have changed since the last update.
+// ----------
+// The changes are collected from the signals of the game between two updates,
+// so when one piece is dragged, only the matrix of its transform node is set.
+// ----------
 QSGNode *PuzzleBoardItem::updatePaintNode(QSGNode *mainNode, UpdatePaintNodeData *)
 {
     // If all the nodes need to be cleared, delete the main node
@@ -146,13 +690,17 @@ QSGNode *PuzzleBoardItem::updatePaintNode(QSGNode *mainNode, UpdatePaintNodeData
             mainNode->removeChildNode(trn);
         }
 
+        foreach (QSGGeometryNode *node, _batchNodes)
+        {
+            mainNode->removeChildNode(node);
+        }
+
         qDeleteAll(_textures);
         qDeleteAll(_transformNodes.values());
+        qDeleteAll(_batchNodes);
         _textures.clear();
-        _transformNodes.clear();
-        _pieceTextureNodes.clear();
-        _strokeTextureNodes.clear();
-        _clearNodes = false;
+        _strokeEntries.clear();
+        clearAtlas();
     }
 
     // Create the main node if it doesn't exist yet
@@ -160,100 +708,82 @@ QSGNode *PuzzleBoardItem::updatePaintNode(QSGNode *mainNode, UpdatePaintNodeData
     {
         mainNode = new QSGNode();
         mainNode->setFlag(QSGNode::OwnedByParent);
+        _clearNodes = true;
     }
 
-    // Order the puzzle pieces by z value (ascending)
-    QList<PuzzlePiece*> puzzleItems = _game->puzzleItems().toList();
-    qSort(puzzleItems.begin(), puzzleItems.end(), PuzzlePiece::puzzleItemAscLessThan);
-
-    // If the number of pieces has changed
-    if (_previousPuzzlePieces != puzzleItems.count())
+    // Start over with every piece of the game, in ascending z order
+    if (_clearNodes)
     {
-        // Check for removed puzzle pieces
-        // IDEA: PuzzlePiece should have a signal for this and then we would only need to iterate through the removed pieces
-        foreach (PuzzlePiece *piece, _transformNodes.keys())
+        _transformNodes.clear();
+        _batchNodes.clear();
+        _primitiveNodes.clear();
+        _addedPieces.clear();
+        _removedPieces.clear();
+        _deletedPrimitives.clear();
+        _pieceChanges.fill(0);
+        _raisedPieces.resize(0);
+        _changedTransformations.resize(0);
+        _changedPrimitives.resize(0);
+
+        // Every piece is queued now, so the queues won't grow when the pieces are dragged
+        int count = _game->puzzleItems().count();
+        _raisedPieces.reserve(count);
+        _changedTransformations.reserve(count);
+        _changedPrimitives.reserve(count);
+
+        // NOTE: this is not done with onPieceAdded(), because that would schedule another frame
+        for (PuzzlePiece *piece = _game->bottomPiece(); piece; piece = piece->pieceAbove())
         {
-            // If the piece no longer exists in the game, remove the node
-            if (!puzzleItems.contains(piece))
-            {
-                QSGTransformNode *trn = _transformNodes[piece];
-                _transformNodes.remove(piece);
-                mainNode->removeChildNode(trn);
-
-                // Remove its child nodes, those will be appended to another transform node
-                trn->removeAllChildNodes();
-                delete trn;
-            }
+            _addedPieces.append(piece);
+            queueChange(piece, PUZZLEBOARDITEM_TRANSFORMATION_CHANGED | PUZZLEBOARDITEM_PRIMITIVES_CHANGED);
         }
 
-        // Check for newly added puzzle pieces
-        // IDEA: PuzzleGame should have a signal for this and we would only need to iterate through the added pieces
-        foreach (PuzzlePiece *piece, puzzleItems)
-        {
-            if (!_transformNodes.contains(piece))
-            {
-                // Create a new transform node
-                // (Child nodes will be appended to it later)
-                QSGTransformNode *trn = new QSGTransformNode();
-                trn->setFlag(QSGNode::OwnedByParent);
-                mainNode->appendChildNode(trn);
-                _transformNodes[piece] = trn;
-
-                // Create child nodes for its primitives if they don't exist yet
-                foreach (const PuzzlePiecePrimitive *pr, piece->primitives())
-                {
-                    QSGTexture *strokeTex = this->window()->createTextureFromImage(pr->stroke().toImage());
-                    QSGSimpleTextureNode *strokeNode = new QSGSimpleTextureNode();
-                    strokeNode->setRect(pr->strokeOffset().x(), pr->strokeOffset().y(), pr->stroke().width(), pr->stroke().height());
-                    strokeNode->setTexture(strokeTex);
-                    strokeNode->setFlag(QSGNode::OwnedByParent);
-                    _strokeTextureNodes[pr] = strokeNode;
-                    _textures.append(strokeTex);
-                    trn->appendChildNode(strokeNode);
-
-                    QSGTexture *pieceTex = this->window()->createTextureFromImage(pr->pixmap().toImage());
-                    QSGSimpleTextureNode *pieceNode = new QSGSimpleTextureNode();
-                    pieceNode->setRect(pr->pixmapOffset().x(), pr->pixmapOffset().y(), pr->pixmap().width(), pr->pixmap().height());
-                    pieceNode->setTexture(pieceTex);
-                    pieceNode->setFlag(QSGNode::OwnedByParent);
-                    _pieceTextureNodes[pr] = pieceNode;
-                    _textures.append(pieceTex);
-                    trn->appendChildNode(pieceNode);
-                }
-            }
-        }
+        _clearNodes = false;
     }
 
-    // Only rearrange the transform nodes if the Z value of a puzzle piece has changed
-    if (_zOrderChanged)
-        mainNode->removeAllChildNodes();
+    // NOTE: this must be done before the new primitives get their nodes, because they may be at the same address
+    releasePrimitives();
 
-    // IDEA: first iterate through only the elements whose transformation is changed
-    //       for this, we need a signal in PuzzleGame (called pieceTransformationChanged) which tells which elements are changed
+    if (_batched)
+    {
+        updateBatch(mainNode);
+        return mainNode;
+    }
 
-    // IDEA: then iterate through the items whose primitives are changed
-    //       for this, we need a signal in PuzzlePiece (called primitivesChanged)
+    // Delete the nodes of the removed pieces
+    foreach (PuzzlePiece *piece, _removedPieces)
+    {
+        QSGTransformNode *trn = _transformNodes.take(piece);
+        if (!trn)
+            continue;
 
-    // IDEA: then iterate through the items to rearrange their Z values, if necessary
-    //       in this case, the sorting is also only needed when the Z values changed
+        mainNode->removeChildNode(trn);
 
-    foreach (PuzzlePiece *piece, puzzleItems)
-    {
-        // Calculate the transformation of this puzzle piece
-        QPointF p = piece->mapToParent(QPointF(0, 0));
-        QTransform transform = QTransform::fromTranslate(p.x(), p.y()).rotate(piece->rotation());
+        // Remove its child nodes, those will be appended to another transform node
+        trn->removeAllChildNodes();
+        delete trn;
+    }
+    _removedPieces.clear();
 
-        // Find the transform node of this puzzle piece
-        QSGTransformNode *trn = _transformNodes[piece];
-        trn->setMatrix(QMatrix4x4(transform));
+    // Create the nodes of the added pieces, on top of the others
+    // (Child nodes will be appended to them later)
+    foreach (PuzzlePiece *piece, _addedPieces)
+    {
+        if (_transformNodes.contains(piece) || !_game->puzzleItems().contains(piece))
+            continue;
 
-        // Only rearrange the transform nodes if the Z value of a puzzle piece has changed
-        if (_zOrderChanged)
-            mainNode->appendChildNode(trn);
+        QSGTransformNode *trn = new QSGTransformNode();
+        trn->setFlag(QSGNode::OwnedByParent);
+        mainNode->appendChildNode(trn);
+        _transformNodes[piece] = trn;
+    }
+    _addedPieces.clear();
 
-        // If the piece count didn't change then the primitives of each piece didn't change either
-        // therefore it is not necessary to adjust them here.
-        if (_previousPuzzlePieces == puzzleItems.count())
+    // Rebuild the child nodes of the pieces whose primitives have changed
+    foreach (PuzzlePiece *piece, _changedPrimitives)
+    {
+        QSGTransformNode *trn = _transformNodes.value(piece, 0);
+        if (!trn)
             continue;
 
         // Remove all child nodes (so that they can be readded in the correct order)
@@ -262,21 +792,53 @@ QSGNode *PuzzleBoardItem::updatePaintNode(QSGNode *mainNode, UpdatePaintNodeData
         // Update the stroke nodes and append them
         foreach (const PuzzlePiecePrimitive *pr, piece->primitives())
         {
-            QSGSimpleTextureNode *strokeNode = _strokeTextureNodes[pr];
-            strokeNode->setRect(pr->strokeOffset().x(), pr->strokeOffset().y(), pr->stroke().width(), pr->stroke().height());
-            trn->appendChildNode(strokeNode);
+            PrimitiveNodes nodes = _primitiveNodes.contains(pr) ? _primitiveNodes.value(pr) : createPrimitiveNodes(pr);
+            if (!nodes.stroke)
+                continue;
+
+            if (nodes.stroke->parent())
+                nodes.stroke->parent()->removeChildNode(nodes.stroke);
+
+            nodes.stroke->setRect(QRectF(nodes.strokeRect).translated(pr->strokeOffset()));
+            trn->appendChildNode(nodes.stroke);
         }
 
         // Update the piece nodes and append them
         foreach (const PuzzlePiecePrimitive *pr, piece->primitives())
         {
-            QSGSimpleTextureNode *pieceNode = _pieceTextureNodes[pr];
-            pieceNode->setRect(pr->pixmapOffset().x(), pr->pixmapOffset().y(), pr->pixmap().width(), pr->pixmap().height());
-            trn->appendChildNode(pieceNode);
+            PrimitiveNodes nodes = _primitiveNodes.value(pr);
+            if (nodes.piece->parent())
+                nodes.piece->parent()->removeChildNode(nodes.piece);
+
+            nodes.piece->setRect(QRectF(nodes.pieceRect).translated(pr->pixmapOffset()));
+            trn->appendChildNode(nodes.piece);
         }
     }
 
-    _zOrderChanged = false;
-    _previousPuzzlePieces = puzzleItems.count();
+    // Move the nodes of the raised pieces to the top, the others keep their order
+    foreach (PuzzlePiece *piece, _raisedPieces)
+    {
+        QSGTransformNode *trn = _transformNodes.value(piece, 0);
+        if (trn)
+        {
+            mainNode->removeChildNode(trn);
+            mainNode->appendChildNode(trn);
+        }
+    }
+
+    // Update the transformation of the pieces which were moved or rotated
+    foreach (PuzzlePiece *piece, _changedTransformations)
+    {
+        QSGTransformNode *trn = _transformNodes.value(piece, 0);
+        if (!trn)
+            continue;
+
+        QPointF p = piece->mapToParent(QPointF(0, 0));
+        QTransform transform = QTransform::fromTranslate(p.x(), p.y()).rotate(piece->rotation());
+        trn->setMatrix(QMatrix4x4(transform));
+    }
+    clearChanges();
+
+    uploadAtlas();
     return mainNode;
 }
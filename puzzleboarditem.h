@@ -21,13 +21,20 @@
 
 #include <QQuickItem>
 #include <QMap>
+#include <QHash>
+#include <QImage>
+#include <QRect>
+#include <QVector>
+#include <QSGGeometry>
+#include <QTransform>
 
 #include "puzzle/puzzlegame.h"
+#include "helpers/rectpacker.h"
 
 class QSGTexture;
 class QSGSimpleTextureNode;
 class QSGTransformNode;
-class QTimer;
+class QSGGeometryNode;
 class PuzzlePiece;
 class PuzzlePiecePrimitive;
 
@@ -35,21 +42,86 @@ class PuzzleBoardItem : public QQuickItem
 {
     Q_OBJECT
     Q_PROPERTY(PuzzleGame* game READ game NOTIFY gameChanged)
+    // Draws the whole board with one geometry node per texture, instead of one node per piece
+    GENPROPERTY_R(bool, _batched, batched)
+    Q_PROPERTY(bool batched READ batched WRITE setBatched NOTIFY batchedChanged)
+
+    // An image in the atlas: the opaque part of the original image and where it is in the atlas
+    // (A negative page means that the image has its own texture.)
+    struct AtlasEntry
+    {
+        int page;
+        QRect trimmedRect, sourceRect;
+        QSGTexture *texture;
+    };
+
+    // A texture of the atlas, the image is kept so that more images can be added to it later
+    // (When none of its images are used anymore, the page is emptied and its texture is deleted.)
+    struct AtlasPage
+    {
+        QImage image;
+        RectPacker packer;
+        QSGTexture *texture;
+        bool dirty;
+        int users;
+        QList<QSGSimpleTextureNode*> nodes;
+    };
+
+    // The nodes of a primitive and the opaque part of their images
+    struct PrimitiveNodes
+    {
+        QSGSimpleTextureNode *stroke, *piece;
+        AtlasEntry strokeEntry, pieceEntry;
+        QRect strokeRect, pieceRect;
+        bool strokeMirroredHorizontally, strokeMirroredVertically, strokeShared;
+    };
+
+    // The vertices of the batched mode which use the same texture, drawn by one geometry node
+    struct BatchRun
+    {
+        QSGTexture *texture;
+        QVector<QSGGeometry::TexturedPoint2D> vertices;
+    };
 
     QMap<PuzzlePiece*, QSGTransformNode*> _transformNodes;
-    QMap<const PuzzlePiecePrimitive*, QSGSimpleTextureNode*> _pieceTextureNodes;
-    QMap<const PuzzlePiecePrimitive*, QSGSimpleTextureNode*> _strokeTextureNodes;
+    QList<QSGGeometryNode*> _batchNodes;
+    QVector<qreal> _batchOriginsX, _batchOriginsY;
+    QMap<const PuzzlePiecePrimitive*, PrimitiveNodes> _primitiveNodes;
     QList<QSGTexture*> _textures;
+    QList<AtlasPage*> _atlasPages;
+    QHash<int, AtlasEntry> _strokeEntries;
+    // The changes of the pieces since the last update
+    // NOTE: the added and raised pieces are kept in the order of adding / raising them
+    QList<PuzzlePiece*> _addedPieces, _removedPieces;
+    QVector<PuzzlePiece*> _raisedPieces, _changedTransformations, _changedPrimitives;
+    // Which of the queues above each piece is in, indexed by the id of the piece
+    QVector<quint8> _pieceChanges;
+    QList<const PuzzlePiecePrimitive*> _deletedPrimitives;
     PuzzleGame *_game;
-    QTimer *_autoUpdater;
 
-    bool _clearNodes, _zOrderChanged;
-    int _previousPuzzlePieces, _autoUpdateRequests;
+    bool _clearNodes;
+
+    AtlasEntry addToAtlas(const QImage &image);
+    AtlasEntry addOwnTexture(const QImage &image);
+    void setNodeTexture(QSGSimpleTextureNode *node, const AtlasEntry &entry);
+    bool uploadAtlas();
+    void clearAtlas();
+    AtlasEntry strokeEntry(const PuzzlePiecePrimitive *pr);
+    void retainEntry(const AtlasEntry &entry);
+    void releaseEntry(const AtlasEntry &entry, QSGSimpleTextureNode *node, bool shared);
+    void releasePrimitives();
+    void queueChange(PuzzlePiece *piece, int change);
+    void clearChanges();
+    PrimitiveNodes createPrimitiveNodes(const PuzzlePiecePrimitive *pr);
+    QSGTexture *entryTexture(const AtlasEntry &entry, QRectF *textureRect) const;
+    void appendQuad(QList<BatchRun> &runs, const QTransform &transform, const QRectF &rect, const AtlasEntry &entry, bool mirrorHorizontally, bool mirrorVertically) const;
+    void updateBatch(QSGNode *mainNode);
 
 public:
     explicit PuzzleBoardItem(QQuickItem *parent = 0);
     virtual ~PuzzleBoardItem();
     PuzzleGame *game() { return _game; }
+    void setBatched(bool batched);
 
 protected:
     QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *);
@@ -61,13 +133,16 @@ protected:
 protected slots:
     void updateGame();
     void clearNodes();
-    void onGameLoaded();
-    void onZOrderChanged();
-    void enableAutoUpdate();
-    void disableAutoUpdate();
+    void onPieceAdded(PuzzlePiece *piece);
+    void onPieceRemoved(PuzzlePiece *piece);
+    void onPieceRaised(PuzzlePiece *piece);
+    void onPieceTransformationChanged(PuzzlePiece *piece);
+    void onPiecePrimitivesChanged(PuzzlePiece *piece);
+    void onPrimitiveAboutToBeDeleted(PuzzlePiecePrimitive *primitive);
 
 signals:
     void gameChanged();
+    void batchedChanged();
 
 };
 
@@ -17,7 +17,6 @@
 // Copyright (C) 2010-2013, Timur Kristóf <venemo@fedoraproject.org>
 
 #include <QPainter>
-#include <QTimer>
 #include <QTouchEvent>
 #include <QMap>
 #include <QGraphicsSceneMouseEvent>
@@ -40,15 +39,17 @@ PuzzleBoardItem::PuzzleBoardItem(QDeclarativeItem *parent)
     setAcceptTouchEvents(true);
 
     _game = new PuzzleGame(this);
-    _autoRepaintRequests = 0;
-    _autoRepainter = new QTimer();
-    _autoRepainter->setInterval(20);
 
-    connect(_autoRepainter, SIGNAL(timeout()), this, SLOT(updateItem()));
+    // The item is only repainted when a piece has changed, the animations of the game
+    // are advanced by the animation timer of Qt, and every step of them changes the pieces.
+    // NOTE: QGraphicsItem::update() is cheap when the item is already waiting for a repaint
     connect(this, SIGNAL(widthChanged()), this, SLOT(updateGame()));
     connect(this, SIGNAL(heightChanged()), this, SLOT(updateGame()));
-    connect(_game, SIGNAL(animationStarting()), this, SLOT(enableAutoRepaint()));
-    connect(_game, SIGNAL(animationStopped()), this, SLOT(disableAutoRepaint()));
+    connect(_game, SIGNAL(pieceAdded(PuzzlePiece*)), this, SLOT(updateItem()));
+    connect(_game, SIGNAL(pieceRemoved(PuzzlePiece*)), this, SLOT(updateItem()));
+    connect(_game, SIGNAL(pieceRaised(PuzzlePiece*)), this, SLOT(updateItem()));
+    connect(_game, SIGNAL(pieceTransformationChanged(PuzzlePiece*)), this, SLOT(updateItem()));
+    connect(_game, SIGNAL(piecePrimitivesChanged(PuzzlePiece*)), this, SLOT(updateItem()));
 }
 
 void PuzzleBoardItem::updateGame()
@@ -76,8 +77,6 @@ bool PuzzleBoardItem::sceneEvent(QEvent *event)
 
         event->accept();
         _game->handleTouchEvent(te);
-        if (!_autoRepainter->isActive())
-            update();
         return true;
     }
 
@@ -88,8 +87,6 @@ void PuzzleBoardItem::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
     event->accept();
     _game->handleMousePress(event->button(), event->pos());
-    if (!_autoRepainter->isActive())
-        update();
 }
 
 void PuzzleBoardItem::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
@@ -102,39 +99,14 @@ void PuzzleBoardItem::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
     event->accept();
     _game->handleMouseMove(event->pos());
-    if (!_autoRepainter->isActive())
-        update();
-}
-
-void PuzzleBoardItem::enableAutoRepaint()
-{
-    _autoRepaintRequests++;
-
-    if (!_autoRepainter->isActive())
-        _autoRepainter->start();
-}
-
-void PuzzleBoardItem::disableAutoRepaint()
-{
-    _autoRepaintRequests--;
-
-    if (_autoRepaintRequests == 0 && _autoRepainter->isActive())
-    {
-        _autoRepainter->stop();
-        update();
-    }
 }
 
 void PuzzleBoardItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
 {
     // Save the original transform of the painter
     QTransform originalTransform = painter->transform();
-    // Order the puzzle pieces by z value (ascending)
-    QList<PuzzlePiece*> puzzleItems = _game->puzzleItems().toList();
-    qSort(puzzleItems.begin(), puzzleItems.end(), PuzzlePiece::puzzleItemAscLessThan);
-
-    // Draw the pieces
-    foreach (PuzzlePiece *piece, puzzleItems)
+    // Draw the pieces in ascending z order
+    for (PuzzlePiece *piece = _game->bottomPiece(); piece; piece = piece->pieceAbove())
     {
         QPointF p = piece->mapToParent(QPointF(0, 0));
         QTransform transform = QTransform::fromTranslate(p.x(), p.y()).rotate(piece->rotation());
@@ -27,7 +27,6 @@
 
 #include "puzzle/puzzlegame.h"
 
-class QTimer;
 class QTouchEvent;
 class QGraphicsSceneMouseEvent;
 
@@ -38,8 +37,6 @@ class PuzzleBoardItem : public QDeclarativeItem
     Q_OBJECT
     Q_PROPERTY(PuzzleGame* game READ game NOTIFY gameChanged)
 
-    QTimer *_autoRepainter;
-    int _autoRepaintRequests;
     PuzzleGame *_game;
 
 public:
@@ -59,10 +56,6 @@ signals:
 private slots:
     void updateItem() { this->update(); }
     void updateGame();
-
-public slots:
-    void enableAutoRepaint();
-    void disableAutoRepaint();
 };
 
 #endif // PUZZLEBOARDITEM_H
@@ -58,6 +58,10 @@ PuzzleBoard {
         appEventHandler.adjustForPlaying()
         progressDialog.close()
     }
+    game.onLoadFailed: {
+        progressDialog.close()
+        failedToStartDialog.open()
+    }
     game.onGameStarted: {
         menuDialog.shouldReenableGame = true
         menuButtonPanel.open()
@@ -108,11 +112,7 @@ PuzzleBoard {
                         game.rotateWithGuide(x, y);
                     }
                 }
-                onPressed: {
-                    gameBoard.enableAutoUpdate();
-                }
                 onReleased: {
-                    gameBoard.disableAutoUpdate();
                     game.stopRotateWithGuide();
                 }
             }